@@ -1,6 +1,12 @@
 #!/bin/bash
 
-gcc -o build/prog -g src/main.c src/chunk.c src/debug.c src/vm.c src/compiler.c src/scanner.c
+SOURCES="src/chunk.c src/debug.c src/vm.c src/compiler.c src/scanner.c src/verifier.c src/value.c src/ir.c src/prepared.c src/cache.c src/native.c src/fiber.c src/aot.c src/memory.c src/perf.c src/snapshot.c src/array.c"
+
+# embeddable library, see include/prepared.h for the api
+mkdir -p build/lib
+(cd build/lib && gcc -c -g -fPIC -pthread $(printf '../../%s ' $SOURCES)) && ar rcs build/libinterpreter.a build/lib/*.o
+
+gcc -o build/prog -g -pthread src/main.c $SOURCES -lm -ldl
 
 if [[ "$1" == "run" && "$?" == 0 ]]; then
 	clear
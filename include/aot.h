@@ -0,0 +1,46 @@
+#ifndef __interpreter_aot__
+#define __interpreter_aot__
+// ../src/aot.c
+
+#include "common.h"
+#include "chunk.h"
+#include "vm.h"
+
+// Ahead of time compilation. A verified program is translated to C, every
+// stack slot a local variable and every constant a literal, and built by
+// the system C compiler into a shared object that is loaded with dlopen().
+// Objects are kept in a directory keyed by a hash of the generated C, so a
+// later process running the same program loads it without compiling. The C
+// is kept next to the object and an object is only loaded when that text
+// is the one just generated, a stale file or a collision builds it again.
+// Without a C compiler nothing is loaded and the caller keeps interpreting.
+//
+// Native code never yields, a vm with a time slice (see fiber.h) has to
+// interpret. Neither does it make arrays, programs with array literals are
+// interpreted too, and so are those with tail calls from one function to
+// another: C has no way to make those run in constant stack. A function
+// calling itself in tail position becomes a loop.
+
+////////// types
+typedef struct aot_program_s aot_program_s;
+
+typedef struct {
+	bool enabled;
+	const char* directory;	// where objects are kept, NULL for $TMPDIR/interpreter-aot
+	const char* compiler;	// NULL for $CC, or cc if that isn't set either. Split
+							// into words at blanks, "ccache gcc" works
+}aot_options_s;
+
+////////// functions
+void set_aot_options(const aot_options_s);
+aot_options_s get_aot_options();
+
+// takes a program verify_program() accepted, NULL if it couldn't be built.
+// The reason goes to stderr.
+aot_program_s* aot_load(chunk_s*);
+void aot_free(aot_program_s*);
+// runs the program with the inputs bound by the host, the same results as
+// vm_run() except that nothing ever yields
+interpret_result_e aot_run(const aot_program_s*, const value_t*, value_t* _result);
+
+#endif //__interpreter_aot__
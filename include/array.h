@@ -0,0 +1,66 @@
+#ifndef __interpreter_array__
+#define __interpreter_array__
+// ../src/array.c
+
+#include "common.h"
+#include "value.h"
+
+// Arrays of doubles, the only heap objects so far. The elements are one
+// contiguous block that starts on a 64 byte boundary, so a vector load never
+// splits a cache line and no two arrays share one. Arrays can't be changed
+// once made, arithmetic on them makes a new one: the optimizer may share or
+// drop copies like it does with numbers, and equal means equal elements.
+//
+// Every vm keeps the arrays it made in a list and frees those its stack no
+// longer holds, see collect_arrays() in vm.c. The kernels below use AVX2
+// where the cpu has it and plain loops otherwise, with the same order of
+// operations, so results don't depend on the machine.
+
+#define ARRAY_ALIGNMENT	 64
+#define ARRAY_LENGTH_MAX (1u << 27)	// 1 GiB of elements
+
+////////// types
+typedef struct array_s {
+	struct array_s* next;	// in the list of the vm that made it
+	uint length;
+	bool marked;			// reachable, only during a collection
+	double* data;			// right behind the header, ARRAY_ALIGNMENT aligned
+}array_s;
+
+typedef enum {
+	ARRAY_ADD = 0,
+	ARRAY_SUBTRACT,
+	ARRAY_MULTIPLY,
+	ARRAY_DIVIDE,
+}array_operation_e;
+
+////////// functions
+// the elements are left undefined
+array_s* new_array(const uint _length);
+void free_array(array_s*);
+// bytes an array of that length takes, header included
+size_t array_size(const uint _length);
+
+void print_array(const array_s*);
+bool arrays_equal(const array_s*, const array_s*);
+
+// _result[i] = _a[i] op _b[i] for i below _length. A step of 0 instead of 1
+// repeats the first element, which is how a number is broadcast over an
+// array. _result may be one of the operands.
+void array_apply(const array_operation_e, double* _result, const double* _a, const uint _a_step,
+				 const double* _b, const uint _b_step, const uint _length);
+void array_negate(double* _result, const double* _a, const uint _length);
+
+// summed in four interleaved lanes that are added up at the end, a script
+// adding the elements one by one can round differently
+double array_sum(const double*, const uint);
+double array_dot(const double*, const double*, const uint);
+// NaNs are skipped like fmin() and fmax() do, NaN only if there is nothing
+// else. An array without elements has neither.
+double array_min(const double*, const uint);
+double array_max(const double*, const uint);
+
+// "avx2" or "scalar", what the kernels run on this machine
+const char* array_kernels();
+
+#endif //__interpreter_array__
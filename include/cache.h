@@ -0,0 +1,64 @@
+#ifndef __interpreter_cache__
+#define __interpreter_cache__
+// ../src/cache.c
+
+#include "common.h"
+#include "chunk.h"
+#include "aot.h"
+
+// Compiled and verified programs keyed by their source text and the compiler
+// options that shape the bytecode. A hit is found
+// by hash and confirmed by comparing the whole text. Least recently used
+// entries are evicted once the cache outgrows its memory budget, an entry
+// still held by someone is only freed once it is released.
+// Every function takes the cache lock, so any thread may use it.
+
+#define CACHE_DEFAULT_BUDGET (64 * 1024 * 1024)
+
+////////// types
+typedef struct cache_entry_s {
+	uint64_t hash;
+	char* source;
+	size_t length;
+	uint optimization_level;	// part of the key, it changes the bytecode
+	bool lazy;					// same, a lazy program has stubs for bodies
+	chunk_s chunk;
+	uint stack_depth;			// proven by verify_program()
+	aot_program_s* native;		// built on first use when aot is enabled, see vm_interpret()
+	bool native_tried;
+	size_t bytes;				// what the entry costs against the budget
+	uint references;			// holders, plus one while it is cached
+	struct cache_entry_s* newer;
+	struct cache_entry_s* older;
+	struct cache_entry_s* next_in_bucket;
+}cache_entry_s;
+
+typedef struct {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint entries;
+	size_t bytes;
+	size_t budget;
+}cache_stats_s;
+
+////////// functions
+void set_cache_budget(const size_t);
+// frees every entry nobody holds and forgets the rest
+void free_cache();
+
+// NULL on a miss. A hit has to be given back with cache_release().
+cache_entry_s* cache_lookup(const char*, const uint, const bool);
+// takes over the verified chunk and returns it as an entry that has to be
+// released. If another thread inserted the same source first, the chunk is
+// freed and that entry is returned instead.
+cache_entry_s* cache_insert(const char*, const uint, const bool, chunk_s*, const uint);
+void cache_release(cache_entry_s*);
+// holds up to _max entries, oldest first so that inserting them in that
+// order rebuilds the same recency. Each one has to be released.
+uint cache_collect(cache_entry_s**, const uint _max);
+
+cache_stats_s cache_stats();
+void print_cache_stats(FILE*);
+
+#endif //__interpreter_cache__
@@ -2,8 +2,8 @@
 #define __interpreter_chunk__
 
 #include "common.h"
+#include "value.h"
 
-typedef double value_t;
 typedef uint8_t instruction_t;
 
 ////////////////////// helper types
@@ -13,6 +13,20 @@ typedef struct {
 	value_t* data; //keep dynamic part at the end
 }literals_array_s;
 
+typedef struct function_s function_s;
+
+typedef struct {
+	uint size;
+	uint capacity;
+	function_s** data;
+}functions_array_s;
+
+typedef struct {
+	uint size;
+	uint capacity;
+	char** data;
+}names_array_s;
+
 typedef enum: uint8_t {
 	OP_UNDEFINED = 0,
 	OP_RETURN,
@@ -22,6 +36,64 @@ typedef enum: uint8_t {
 	OP_DIVIDE,
 	OP_NEGATION,
 	OP_CONSTANT,
+	OP_NIL,
+	OP_TRUE,
+	OP_FALSE,
+	// quickened forms of the generic arithmetic above. run() rewrites the
+	// generic opcode in place once it has seen the operand types, and writes
+	// the generic one back if the guard of a specialized opcode ever fails.
+	OP_ADD_NUM_NUM,
+	OP_SUBTRACT_NUM_NUM,
+	OP_MULTIPLY_NUM_NUM,
+	OP_DIVIDE_NUM_NUM,
+	OP_ADD_INT_INT,		 // exact int64, an overflowing result is a double
+	OP_SUBTRACT_INT_INT,
+	OP_MULTIPLY_INT_INT,
+	OP_NOT,
+	OP_EQUAL,
+	OP_NOT_EQUAL,
+	OP_LESS,
+	OP_LESS_EQUAL,
+	OP_GREATER,
+	OP_GREATER_EQUAL,
+	OP_POP,
+	OP_PRINT,
+	OP_GET_LOCAL,
+	OP_SET_LOCAL,
+	OP_GET_INPUT,	// value the host bound to the script input, see prepared.h
+	// jumps carry a 16 bit big endian offset relative to the next instruction
+	OP_JUMP,
+	OP_LOOP,
+	OP_JUMP_IF_FALSE,		   // pops the condition
+	OP_JUMP_IF_FALSE_OR_POP,   // keeps the condition if it jumps, for 'and'
+	OP_JUMP_IF_TRUE_OR_POP,	   // keeps the condition if it jumps, for 'or'
+	// comparison fused with the branch it feeds, pops both operands and jumps
+	// when the comparison is false, so no boolean is ever materialized
+	OP_JUMP_IF_NOT_EQUAL,
+	OP_JUMP_IF_EQUAL,
+	OP_JUMP_IF_NOT_LESS,
+	OP_JUMP_IF_NOT_LESS_EQUAL,
+	OP_JUMP_IF_NOT_GREATER,
+	OP_JUMP_IF_NOT_GREATER_EQUAL,
+	// operands: function index, argument count
+	OP_CALL,
+	OP_TAIL_CALL,	// replaces the current frame instead of pushing one
+	// operands: native index, argument count. The _1/_2 forms only carry the
+	// index, they call natives of a fixed numeric signature, see native.h
+	OP_CALL_NATIVE,
+	OP_CALL_NATIVE_1,
+	OP_CALL_NATIVE_2,
+	// stack shuffles for values the optimizer shares between several uses
+	OP_PICK,		// pushes a copy of the value n below the top
+	OP_SLIDE,		// drops n values from under the top one
+	// operand: function index. The whole code of a function whose body
+	// wasn't compiled up front, it compiles the body on the first call and
+	// continues there, see compile_function() in compiler.h
+	OP_LAZY,
+	// arrays of doubles, see array.h. Arithmetic and negation take them too
+	OP_ARRAY,		// operand: element count, pops the elements
+	OP_ARRAY_FILL,	// pops a value and a length, [x; n]
+	OP_INDEX,		// pops the array and the index
 }opcode_e;
 
 ////////////////////// chunk
@@ -36,13 +108,48 @@ typedef struct {
 	literals_array_s literals;
 	uint8_t* data;
 	uint* lines;
+	bool verified;		// set by verify_chunk(), see verifier.h
+	uint stack_depth;	// proven max stack depth, valid only when verified
+	uint frame_depth;	// deepest frame of the functions it owns, set by verify_program()
+	functions_array_s functions; // only the top level chunk owns any
+	names_array_s inputs;		 // same, indexed by OP_GET_INPUT
 }chunk_s;
 
+// a function body the compiler only skimmed, see compiler_options_s.lazy
+typedef struct {
+	char* source;	// from the '(' of the parameters to the closing '}'
+	uint length;
+	uint line;		// of the '('
+	uint optimization_level;
+	chunk_s* body;	// compiled on the first call, written once under the compiler lock
+	bool failed;	// the body didn't compile, every call fails
+}lazy_body_s;
+
+struct function_s {
+	chunk_s chunk;	// just OP_LAZY while lazy is set
+	uint8_t arity;
+	bool defined;	// false while it was only called ahead of its declaration
+	char* name;
+	lazy_body_s* lazy;	// NULL when the body was compiled with the script
+};
+
 ///////// functions
 void init_chunk(chunk_s*);
+// a chunk of just that instruction, without room for literals
+void init_stub_chunk(chunk_s*, const opcode_e, const uint8_t _operand, const uint _line);
 void free_chunk(chunk_s*);
 void append_chunk(chunk_s*, const opcode_e, const uint);
+// heap bytes the chunk holds, including the functions and inputs it owns
+size_t chunk_memory(const chunk_s*);
 int append_literal(chunk_s*, const value_t);
 
+function_s* new_function(const char*, const uint);
+void free_function(function_s*);
+// the code a call runs, NULL for a lazy body nobody called yet
+chunk_s* function_body(function_s*);
+int append_function(chunk_s*, function_s*);
+int append_input(chunk_s*, const char*, const uint);
+int find_input(const chunk_s*, const char*, const uint);
+
 
 #endif //__interpreter_chunk__
@@ -4,8 +4,38 @@
 
 #include "vm.h"
 
+typedef struct {
+	uint optimization_level;	// 0 emits straight from the parser, 1 goes through the IR (see ir.h)
+	bool dump_ir;				// print the IR of every region before it is lowered
+	// compile() only skims function bodies to their closing brace and each
+	// is compiled on its first call, errors in a body are reported then.
+	// compile_with_inputs() ignores it, a body could name an input nobody
+	// bound.
+	bool lazy;
+	// scan the whole source into a token stream before parsing instead of
+	// through a window of tokens, see scanner.h. The bytecode is the same,
+	// the stream costs memory for every token of the source.
+	bool token_stream;
+}compiler_options_s;
+
+typedef struct {
+	uint64_t skimmed;	// bodies left for their first call
+	uint64_t compiled;	// of those, the ones that got called
+	uint64_t failed;	// called, but didn't compile
+}lazy_stats_s;
 
 bool compile(const char*, chunk_s*);
+// like compile(), but names declared nowhere become inputs of the script
+// instead of errors, their values are bound by the host (see prepared.h)
+bool compile_with_inputs(const char*, chunk_s*);
+void set_compiler_options(const compiler_options_s);
+compiler_options_s get_compiler_options();
+
+// compiles and verifies the body of a lazy function of the script, once,
+// any thread may call it. NULL if it fails, the reason goes to stderr.
+chunk_s* compile_function(chunk_s* _script, function_s*);
+lazy_stats_s lazy_stats();
+void print_lazy_stats(FILE*);
 
 
 
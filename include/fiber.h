@@ -0,0 +1,58 @@
+#ifndef __interpreter_fiber__
+#define __interpreter_fiber__
+// ../src/fiber.c
+
+#include <pthread.h>
+
+#include "common.h"
+#include "prepared.h"
+
+// Many scripts on a few threads. A fiber is a prepared script that runs in
+// time slices (see vm_set_slice()), between two slices it waits in the
+// ready queue of its priority. Workers always take the oldest fiber of the
+// most urgent non-empty queue, so fibers of the same priority round-robin
+// and a runaway script only ever holds a thread for one slice. A fiber
+// with a quota is stopped with INTERPRETER_QUOTA_EXCEEDED once it used up
+// that many slices.
+
+#define FIBER_PRIORITIES 4
+
+////////// types
+typedef struct fiber_s {
+	prepared_s* prepared;
+	uint priority;				// 0 runs first
+	uint64_t quota;				// slices it may use, 0 for no limit
+	uint64_t slices;			// slices used so far
+	bool started;
+	interpret_result_e status;	// INTERPRETER_UNDEFINED until it finished
+	value_t result;				// valid when status is INTERPRETER_OK
+	struct fiber_s* next;
+}fiber_s;
+
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t ready;		// a fiber was queued, or the scheduler stops
+	pthread_cond_t finished;	// a fiber finished
+	fiber_s* heads[FIBER_PRIORITIES];
+	fiber_s* tails[FIBER_PRIORITIES];
+	uint live;					// spawned and not finished yet
+	bool stopping;
+	uint64_t slice;
+	pthread_t* threads;
+	uint thread_count;
+}scheduler_s;
+
+////////// functions
+scheduler_s* new_scheduler(const uint _threads, const uint64_t _slice);
+// stops the workers once their current slice is done. Fibers that didn't
+// finish keep INTERPRETER_UNDEFINED and are still the caller's to free.
+void free_scheduler(scheduler_s*);
+
+// takes over the prepared script, its inputs have to be bound already
+fiber_s* spawn_fiber(scheduler_s*, prepared_s*, const uint _priority, const uint64_t _quota);
+// blocks until every fiber spawned so far finished
+void wait_fibers(scheduler_s*);
+// only once it finished, or after free_scheduler()
+void free_fiber(fiber_s*);
+
+#endif //__interpreter_fiber__
@@ -0,0 +1,66 @@
+#ifndef __interpreter_ir__
+#define __interpreter_ir__
+// ../src/ir.c
+
+#include "common.h"
+#include "chunk.h"
+
+// SSA form of the pure expression code between two side effects. The
+// compiler pushes values here instead of emitting bytecode, the operand
+// stack is mirrored on value ids and every value is defined exactly once.
+// Anything the IR can't express makes the compiler lower what is pending
+// back to bytecode first.
+
+#define IR_VALUES_MAX 128	// keeps every OP_PICK distance below 256
+#define IR_STACK_MAX  64
+
+////////// types
+typedef enum {
+	IR_CONSTANT = 0,
+	IR_LOCAL,
+	IR_INPUT,
+	IR_UNARY,
+	IR_BINARY,
+}ir_kind_e;
+
+typedef struct {
+	ir_kind_e kind;
+	opcode_e op;			// OP_NEGATION, OP_ADD, ... for unary/binary, OP_CONSTANT, OP_NIL, ... for constants
+	value_t constant;
+	uint8_t slot;			// local slot for IR_LOCAL, input index for IR_INPUT
+	uint16_t left;
+	uint16_t right;
+	uint line;
+	int literal;			// constant pool index once lowered, -1 before
+}ir_value_s;
+
+typedef struct {
+	ir_value_s values[IR_VALUES_MAX];
+	uint value_count;
+	uint16_t stack[IR_STACK_MAX];
+	uint stack_size;
+	bool dump;
+	bool error;				// ran out of constant slots while lowering
+}ir_s;
+
+////////// functions
+void init_ir(ir_s*, const bool);
+bool ir_empty(const ir_s*);
+
+// each returns false when the IR can't take the value, the caller has to
+// lower what is pending and emit the instruction itself
+bool ir_constant(ir_s*, const value_t, const uint);
+bool ir_literal(ir_s*, const opcode_e, const uint);
+bool ir_local(ir_s*, const uint8_t, const uint);
+bool ir_input(ir_s*, const uint8_t, const uint);
+bool ir_unary(ir_s*, const opcode_e, const uint);
+bool ir_binary(ir_s*, const opcode_e, const uint);
+// throws away the value on top if nothing can observe it (dead code)
+bool ir_drop(ir_s*);
+
+// appends bytecode for every pending value, in stack order, and resets the
+// IR. Returns the offset of the final instruction if it is a comparison
+// (so a branch can fuse with it), -1 otherwise.
+int ir_lower(ir_s*, chunk_s*);
+
+#endif //__interpreter_ir__
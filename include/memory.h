@@ -0,0 +1,66 @@
+#ifndef __interpreter_memory__
+#define __interpreter_memory__
+// ../src/memory.c
+
+#include "common.h"
+
+// Every allocation the interpreter makes goes through reallocate(), which
+// keeps live bytes, peak bytes, counts and a size histogram per subsystem.
+// Callers pass the size they are giving back, so no header is put in front
+// of the blocks. The counters are atomic, any thread may allocate.
+
+#define MEMORY_SIZE_CLASSES 16	// class n counts sizes up to 16 << n bytes, the last one everything larger
+
+////////// types
+typedef enum {
+	MEMORY_BYTECODE = 0,
+	MEMORY_LINES,
+	MEMORY_LITERALS,
+	MEMORY_TOKENS,		// token streams, only while compiling
+	MEMORY_FUNCTIONS,	// function records and their names
+	MEMORY_INPUTS,		// input names of scripts and the values bound to them
+	MEMORY_STACK,		// value stacks and call frames of vm instances
+	MEMORY_CACHE,		// cache entries, source copies and buckets
+	MEMORY_HANDLES,		// vms, prepared scripts, fibers, schedulers, native code
+	MEMORY_SCRATCH,		// working memory of the verifier and the aot translator, file sources
+	MEMORY_OBJECTS,		// heap objects, arrays so far
+	MEMORY_SUBSYSTEMS,
+}memory_subsystem_e;
+
+typedef struct {
+	size_t live;
+	size_t peak;
+	uint64_t allocations;	// including every growth of a block
+	uint64_t frees;
+	uint64_t size_classes[MEMORY_SIZE_CLASSES];
+}memory_stats_s;
+
+////////// helpers
+#define ALLOCATE(type, count, subsystem) \
+	((type*)reallocate(NULL, 0, sizeof(type) * (count), subsystem))
+#define GROW_ARRAY(type, pointer, old_count, new_count, subsystem) \
+	((type*)reallocate(pointer, sizeof(type) * (old_count), sizeof(type) * (new_count), subsystem))
+#define FREE(type, pointer, subsystem) \
+	reallocate(pointer, sizeof(type), 0, subsystem)
+#define FREE_ARRAY(type, pointer, count, subsystem) \
+	reallocate(pointer, sizeof(type) * (count), 0, subsystem)
+
+////////// functions
+// a new size of 0 frees, a NULL pointer allocates. Exits if memory runs out.
+void* reallocate(void*, const size_t _old_size, const size_t _new_size, const memory_subsystem_e);
+void* allocate_zeroed(const size_t, const memory_subsystem_e);
+// a block starting on a multiple of _alignment, a power of two. It can't be
+// grown and has to go back through free_aligned().
+void* allocate_aligned(const size_t, const size_t _alignment, const memory_subsystem_e);
+void free_aligned(void*, const size_t, const memory_subsystem_e);
+
+memory_stats_s memory_stats(const memory_subsystem_e);
+// live bytes of all subsystems together, and the peak of that sum
+size_t memory_live();
+size_t memory_peak();
+const char* memory_subsystem_name(const memory_subsystem_e);
+void print_memory_stats(FILE*);
+// prints every subsystem still holding memory, false if there was one
+bool check_memory_leaks(FILE*);
+
+#endif //__interpreter_memory__
@@ -0,0 +1,59 @@
+#ifndef __interpreter_native__
+#define __interpreter_native__
+// ../src/native.c
+
+#include "common.h"
+#include "value.h"
+
+// Host functions callable from scripts. They are resolved by name at
+// compile time and called by index, with their arguments left in place on
+// the vm stack. Natives with a fixed numeric signature skip value_t
+// entirely: the call site gets OP_CALL_NATIVE_1/_2, which type checks the
+// arguments and calls the plain C function.
+// The math primitives and the array reductions are always there, everything
+// else has to be defined before the scripts using it are compiled. Names are
+// not copied. A name can be taken once per arity, min(a, b) of two numbers
+// and min(a) of an array are two natives.
+
+#define NATIVES_MAX (UINT8_MAX + 1)
+
+////////// types
+// _arguments points at the first argument on the stack. Returns false if
+// the call failed, which raises a runtime error.
+typedef bool (*native_fn_t)(value_t* _arguments, value_t* _result);
+typedef double (*native_number_1_t)(double);
+typedef double (*native_number_2_t)(double, double);
+
+typedef enum {
+	NATIVE_GENERIC = 0,
+	NATIVE_NUMBER_1,
+	NATIVE_NUMBER_2,
+}native_kind_e;
+
+typedef struct {
+	const char* name;
+	uint8_t arity;
+	native_kind_e kind;
+	union {
+		native_fn_t generic;
+		native_number_1_t number_1;
+		native_number_2_t number_2;
+	}as;
+}native_s;
+
+////////// variables
+extern native_s natives[NATIVES_MAX];
+extern uint native_count;
+
+////////// functions
+// each returns false if the name is taken for that arity or there is no
+// room left
+bool define_native(const char*, const uint8_t, native_fn_t);
+bool define_native_number_1(const char*, native_number_1_t);
+bool define_native_number_2(const char*, native_number_2_t);
+// the first native of that name, whatever its arity
+int find_native(const char*, const uint);
+int resolve_native(const char*, const uint, const uint8_t _arity);
+const char* native_name(const uint);
+
+#endif //__interpreter_native__
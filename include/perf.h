@@ -0,0 +1,54 @@
+#ifndef __interpreter_perf__
+#define __interpreter_perf__
+// ../src/perf.c
+
+#include "common.h"
+
+// Hardware counters around the phases of vm_interpret(), read with
+// perf_event_open(). Only user space of the calling thread is counted, so
+// it works with perf_event_paranoid up to 2. A counter the kernel or the
+// cpu doesn't offer (iTLB misses in most virtual machines) is left out on
+// its own, and without any counter the report still has wall time and
+// bytecode instructions. Counters that were multiplexed are scaled up to
+// the time they were enabled.
+
+////////// types
+typedef enum {
+	PERF_CYCLES = 0,
+	PERF_INSTRUCTIONS,
+	PERF_BRANCH_MISSES,
+	PERF_L1D_MISSES,	// read misses
+	PERF_ITLB_MISSES,
+	PERF_COUNTERS,
+}perf_counter_e;
+
+typedef enum {
+	PERF_COMPILE = 0,	// compile() alone, verifying is not part of it
+	PERF_RUN,			// vm_run() or aot_run()
+	PERF_PHASES,
+}perf_phase_e;
+
+typedef struct {
+	uint64_t counts[PERF_COUNTERS];
+	uint64_t nanoseconds;
+	uint64_t bytecodes;		// instructions dispatched, 0 for native code
+	uint64_t times;			// how often the phase was entered
+}perf_totals_s;
+
+////////// functions
+// opens the counters for the calling thread, which has to be the one that
+// calls perf_begin() and perf_end(). false if none could be opened, the
+// reason goes to the report.
+bool perf_init();
+void perf_free();
+bool perf_enabled();
+
+// a no-op unless perf_init() was called
+void perf_begin(const perf_phase_e);
+void perf_end(const perf_phase_e, const uint64_t _bytecodes);
+
+perf_totals_s perf_totals(const perf_phase_e);
+const char* perf_counter_name(const perf_counter_e);
+void print_perf_report(FILE*);
+
+#endif //__interpreter_perf__
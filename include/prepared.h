@@ -0,0 +1,45 @@
+#ifndef __interpreter_prepared__
+#define __interpreter_prepared__
+// ../src/prepared.c
+
+#include "common.h"
+#include "value.h"
+#include "vm.h"
+
+// Compile once, run many. A prepared script owns nothing but the state of a
+// single run - its bound inputs and a vm instance - and shares the compiled,
+// verified program with all of its clones. Names the source never declares
+// are its inputs, so "a * b + c" has three of them.
+//
+// One handle must not be executed on two threads at once, its clones can.
+// The usual pattern is one clone per thread.
+
+////////// types
+typedef struct program_s program_s;
+
+typedef struct {
+	program_s* program;
+	value_t* inputs;
+	vm_s* vm;
+}prepared_s;
+
+////////// functions
+// NULL if the source doesn't compile or verify, the errors go to stderr.
+// Safe to call from several threads, compilation itself is serialized.
+prepared_s* prepare(const char*);
+prepared_s* clone_prepared(const prepared_s*);
+void free_prepared(prepared_s*);
+
+// index of the input with that name, -1 if there is none
+int prepared_input(const prepared_s*, const char*);
+// false if there is no input with that name
+bool prepared_bind(prepared_s*, const char*, const double);
+void prepared_bind_at(prepared_s*, const uint, const double);
+// inputs never bound are nil. _result is written on INTERPRETER_OK only, an
+// array in it lives until the handle runs again.
+interpret_result_e prepared_execute(prepared_s*, value_t* _result);
+// starts a run without waiting for the result, for a vm with a time slice
+// that may yield (see fiber.h). The result ends up in vm->result.
+interpret_result_e prepared_start(prepared_s*);
+
+#endif //__interpreter_prepared__
@@ -10,6 +10,7 @@ typedef enum {
   // Single-character tokens.
     TOKEN_LEFT_PAREN, TOKEN_RIGHT_PAREN,
     TOKEN_LEFT_BRACE, TOKEN_RIGHT_BRACE,
+    TOKEN_LEFT_BRACKET, TOKEN_RIGHT_BRACKET,
     TOKEN_COMMA, TOKEN_DOT, TOKEN_MINUS, TOKEN_PLUS,
     TOKEN_SEMICOLON, TOKEN_SLASH, TOKEN_STAR,
     // One or two character tokens.
@@ -35,8 +36,50 @@ typedef struct {
 	uint line;
 }token_s;
 
+// Tokens as a struct of arrays. Token i is in slot i & mask: types[slot],
+// the lengths[slot] bytes at source + offsets[slot].
+//
+// A whole stream is the source scanned in one pass, mask has every bit set.
+// Since most neighbouring tokens share a line its lines are run length
+// encoded: a run starts at token run_starts[r] and lasts until the next one
+// starts.
+//
+// A window only keeps the last capacity tokens and is filled from
+// scan_token() as they are asked for, so it needs no memory for the source
+// as a whole. Its lines are kept per slot.
+typedef struct {
+	const char* source;
+	uint count;				// tokens scanned so far
+	uint capacity;
+	uint mask;
+	uint8_t* types;
+	uint32_t* offsets;		// into messages for TOKEN_ERROR, whose text isn't in the source
+	uint16_t* lengths;
+	uint32_t* lines;		// NULL for a whole stream
+	uint run_count;
+	uint run_capacity;
+	uint32_t* run_starts;
+	uint32_t* run_lines;
+	uint message_count;
+	const char** messages;
+}token_stream_s;
+
 ////////// functions
 void init_scanner(const char* _code);
 token_s scan_token();
 
+// always ends with a TOKEN_EOF. _line is the line the source starts on.
+void scan_tokens(token_stream_s*, const char*, const uint _line);
+// scans the first window
+void open_token_window(token_stream_s*, const char*, const uint _line);
+// scans on until token _index is there, tokens before _keep may be dropped
+// to make room. Past the end every token is TOKEN_EOF.
+void fill_token_window(token_stream_s*, const uint _index, const uint _keep);
+void free_token_stream(token_stream_s*);
+// token _index as scan_token() would have returned it
+token_s stream_token(const token_stream_s*, const uint _index);
+// line of token _index. _run is a cursor into the runs, so walking the
+// tokens of a whole stream in order never searches, start it at 0.
+uint stream_line(const token_stream_s*, uint* _run, const uint _index);
+
 #endif //__interpreter_scanner__
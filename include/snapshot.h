@@ -0,0 +1,43 @@
+#ifndef __interpreter_snapshot__
+#define __interpreter_snapshot__
+// ../src/snapshot.c
+
+#include "common.h"
+
+// Images of the program cache. Between two scripts the vm keeps nothing
+// but the cache: its stack is empty again and there are no globals or
+// heap objects yet. An image holds every cached program as it is at that
+// moment, quickened bytecode included, so a new process that loads it runs
+// those sources at once, without compiling them or warming them up again.
+//
+// An image is relocatable, everything in it is a size or an index. It is
+// mapped with mmap() and checked for its format version and a checksum of
+// the whole payload. Since run() trusts its bytecode, every program is
+// verified again before it goes into the cache. The natives an image was
+// made with have to be defined, under the same indices, when it is loaded.
+
+#define SNAPSHOT_VERSION 3	// 2: functions may be lazy, see compiler.h
+							// 3: programs are keyed by the lazy option too
+
+////////// types
+typedef enum {
+	SNAPSHOT_UNDEFINED = 0,
+	SNAPSHOT_OK,
+	SNAPSHOT_IO_ERROR,			// errno has the reason
+	SNAPSHOT_NOT_AN_IMAGE,
+	SNAPSHOT_BAD_VERSION,		// made by another version or on another byte order
+	SNAPSHOT_BAD_CHECKSUM,
+	SNAPSHOT_TRUNCATED,			// a record runs past the end of the payload
+	SNAPSHOT_NATIVES_DIFFER,
+	SNAPSHOT_UNVERIFIABLE,		// a program failed verification or declares inputs
+}snapshot_result_e;
+
+////////// functions
+// writes the cache to the file, replacing it at once once it is complete
+snapshot_result_e save_snapshot(const char*);
+// adds the programs of the image to the cache, nothing if the image is
+// rejected. _programs gets how many were added, it may be NULL.
+snapshot_result_e load_snapshot(const char*, uint* _programs);
+const char* snapshot_result_message(const snapshot_result_e);
+
+#endif //__interpreter_snapshot__
@@ -0,0 +1,65 @@
+#ifndef __interpreter_value__
+#define __interpreter_value__
+// ../src/value.c
+
+#include "common.h"
+
+////////// types
+typedef enum {
+	VAL_NIL = 0,
+	VAL_BOOL,
+	VAL_NUMBER,	// double
+	VAL_INT,	// int64_t, exact until an operation overflows, see value.c
+	VAL_ARRAY,	// of doubles, owned by the vm that made it, see array.h
+}value_type_e;
+
+typedef struct {
+	value_type_e type;
+	union {
+		bool boolean;
+		double number;
+		int64_t integer;
+		struct array_s* array;
+	}as;
+}value_t;
+
+////////// helpers
+#define NIL_VAL				((value_t){VAL_NIL,	   {.number = 0}})
+#define BOOL_VAL(_value)	((value_t){VAL_BOOL,   {.boolean = (_value)}})
+#define NUMBER_VAL(_value)	((value_t){VAL_NUMBER, {.number = (_value)}})
+#define INT_VAL(_value)		((value_t){VAL_INT,	   {.integer = (_value)}})
+#define ARRAY_VAL(_value)	((value_t){VAL_ARRAY,  {.array = (_value)}})
+
+#define IS_NIL(_value)		((_value).type == VAL_NIL)
+#define IS_BOOL(_value)		((_value).type == VAL_BOOL)
+#define IS_NUMBER(_value)	((_value).type == VAL_NUMBER)
+#define IS_INT(_value)		((_value).type == VAL_INT)
+#define IS_NUMERIC(_value)	(IS_NUMBER(_value) || IS_INT(_value))
+#define IS_ARRAY(_value)	((_value).type == VAL_ARRAY)
+
+#define AS_BOOL(_value)		((_value).as.boolean)
+#define AS_NUMBER(_value)	((_value).as.number)
+#define AS_INT(_value)		((_value).as.integer)
+#define AS_ARRAY(_value)	((_value).as.array)
+// any numeric value as a double
+#define AS_FLOAT(_value)	(IS_INT(_value) ? (double)AS_INT(_value) : AS_NUMBER(_value))
+
+////////// functions
+void print_value(const value_t);
+// arrays are equal when their elements are
+bool values_equal(const value_t, const value_t);
+bool is_falsey(const value_t);
+
+// arithmetic on two numeric values. Two ints stay an int as long as the
+// result is exact and become a double when it overflows, a double on either
+// side makes it a double. Division always divides as doubles.
+value_t add_values(const value_t, const value_t);
+value_t subtract_values(const value_t, const value_t);
+value_t multiply_values(const value_t, const value_t);
+value_t divide_values(const value_t, const value_t);
+value_t negate_value(const value_t);
+// -1, 0 or 1 as a is less than, equal to or greater than b, 2 if either is
+// NaN and nothing holds
+int compare_values(const value_t, const value_t);
+
+#endif //__interpreter_value__
@@ -0,0 +1,54 @@
+#ifndef __interpreter_verifier__
+#define __interpreter_verifier__
+// ../src/verifier.c
+
+#include "common.h"
+#include "chunk.h"
+
+////////// types
+typedef enum {
+	VERIFY_UNDEFINED = 0,
+	VERIFY_OK,
+	VERIFY_EMPTY_CHUNK,
+	VERIFY_BAD_OPCODE,
+	VERIFY_TRUNCATED_INSTRUCTION,
+	VERIFY_BAD_CONSTANT,
+	VERIFY_BAD_LOCAL,
+	VERIFY_BAD_INPUT,
+	VERIFY_BAD_JUMP,
+	VERIFY_BAD_CALL,
+	VERIFY_BAD_NATIVE,
+	VERIFY_STACK_UNDERFLOW,
+	VERIFY_STACK_MISMATCH,
+	VERIFY_MISSING_RETURN,
+}verify_result_e;
+
+typedef struct {
+	verify_result_e result;
+	const chunk_s* chunk; // chunk of the offending instruction
+	uint offset;	// offset of the offending instruction
+	uint max_depth; // proven upper bound of the value stack
+}verify_report_s;
+
+////////// functions
+// proves that the chunk can be run without any runtime checks. On success
+// marks the chunk as verified and records the stack depth it needs, counted
+// from the frame base where the arguments already sit. Calls and inputs are
+// checked against the script that owns them.
+verify_report_s verify_chunk(chunk_s*, const chunk_s*, const uint);
+// same, and fills _depths (one entry per byte of the chunk) with the stack
+// depth every instruction starts at, -1 where no instruction starts or
+// nothing reaches it
+verify_report_s verify_chunk_depths(chunk_s*, const chunk_s*, const uint, int* _depths);
+// verifies the script and every function it owns. max_depth of the report
+// is the depth of the script's own frame and frame_depth of the script that
+// of the deepest function, run() keeps room for as many of those as it has
+// call frames. A lazy function counts with its arguments only, run() makes
+// room for its body once it is compiled.
+verify_report_s verify_program(chunk_s*);
+const char* verify_result_message(const verify_result_e);
+// source line of the offending instruction, the last one of the chunk for
+// an offset past its end and 0 for an empty chunk
+int verify_report_line(const verify_report_s*);
+
+#endif //__interpreter_verifier__
@@ -5,24 +5,81 @@
 #include "chunk.h"
 #include "common.h"
 
-#define STACK_MAX 1024 //hell yeah - 1kb!
-
 typedef enum {
 	INTERPRETER_UNDEFINED = 0,
 	INTERPRETER_OK,
 	INTERPRETER_COMPILER_ERROR,
+	INTERPRETER_VERIFIER_ERROR,
 	INTERPRETER_RUNTIME_ERROR,
+	INTERPRETER_YIELD,			// used up its time slice, vm_resume() continues
+	INTERPRETER_QUOTA_EXCEEDED,	// stopped by the scheduler, see fiber.h
 }interpret_result_e;
 
+// deepest recursion a program may go to, the frames only grow that far
+// when it does
+#define FRAMES_MAX 1024
+
+// how run() keeps the stack, see there. Both run every program the same.
+// Cached only pays off in a build without optimization; at -O2 the two are
+// even on arithmetic and plain is faster on calls, which cached spills for.
+typedef enum {
+	DISPATCH_PLAIN = 0,	// every value in vm->stack
+	DISPATCH_CACHED,	// the top one or two values in locals of run()
+}dispatch_e;
+
 typedef struct {
+	chunk_s* chunk;
+	uint8_t* pc;	// where to resume once the frame above it returns
+	value_t* base;	// slot 0 of the frame, where the first argument sits
+}call_frame_s;
+
+typedef struct {
+	// registers of the running frame, only spilled to frames[] on a call.
+	// run() keeps pc and sp in locals, they are only current here while it
+	// isn't running or has handed the vm to somebody else, see there.
 	chunk_s* chunk;
 	uint8_t* pc;
-	value_t  stack[STACK_MAX];
+	value_t* base;
+	functions_array_s* functions;
+	call_frame_s* frames;
+	uint frame_count;
+	uint frame_capacity;
+	uint frame_depth;	// of the deepest function so far, see fit_stack() in vm.c
+	value_t* stack;	//sized from the proven depths, grows with the frames
+	uint	 stack_capacity;
 	value_t* sp;
+	const value_t* inputs;	// values bound to the script inputs, see prepared.h
+	value_t result;			// what the script returned, valid after INTERPRETER_OK
+							// and an array in it until the vm runs again
+	struct array_s* arrays;	// every array this vm made and didn't free yet
+	struct array_s* spares;	// dead ones kept until the next collection, for reuse
+	size_t array_bytes;		// of arrays, not counting spares
+	size_t collect_at;		// array_bytes that start the next collection
+	uint64_t slice;			// time slice in bytecode bytes, 0 runs to the end
+	int64_t slice_left;
+	uint64_t dispatched;	// instructions run so far, for the report of perf.h
 }vm_s;
 
 void vm_init();
 void vm_free();
 interpret_result_e vm_interpret(const char*);
 
+// vm instances besides the one vm_interpret() uses. Each one has its own
+// stack and frames, so any number of them can run at once, even the same
+// program on several threads (see rewrite_instruction() in vm.c).
+vm_s* new_vm();
+void free_vm(vm_s*);
+// runs a program verify_program() accepted, _stack_depth is the max_depth
+// it reported. The arrays of the run before are freed.
+interpret_result_e vm_run(vm_s*, chunk_s*, const uint _stack_depth, const value_t*);
+// With a slice set, run() returns INTERPRETER_YIELD once it ran about that
+// many bytes of bytecode. It is charged at back edges and calls, the only
+// ways to run for longer than the code is long, so a slice can overshoot
+// by one straight-line stretch at most.
+void vm_set_slice(vm_s*, const uint64_t);
+interpret_result_e vm_resume(vm_s*);
+// for every vm, taken up by the next run() or vm_resume()
+void set_dispatch(const dispatch_e);
+dispatch_e get_dispatch();
+
 #endif //__interpreter_vm__
@@ -0,0 +1,677 @@
+#include "../include/aot.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "../include/native.h"
+#include "../include/compiler.h"
+#include "../include/verifier.h"
+#include "../include/memory.h"
+
+//////////// static types
+// what the generated code calls back into. The prologue below declares the
+// same struct, field for field.
+typedef struct {
+	value_t (*arithmetic[4])(const value_t, const value_t);	// add, subtract, multiply, divide
+	value_t (*negate)(const value_t);
+	int (*compare)(const value_t, const value_t);
+	bool (*equal)(const value_t, const value_t);
+	void (*print)(const value_t);
+	void (*error)(const uint, const char*);
+	void* natives[NATIVES_MAX];
+}aot_host_s;
+
+typedef bool (*aot_entry_t)(const aot_host_s*, const value_t*, value_t*);
+
+struct aot_program_s {
+	void* library;
+	aot_entry_t entry;
+	aot_host_s host;
+};
+
+typedef struct {
+	char* data;
+	size_t size;
+	size_t capacity;
+}source_s;
+
+//////////// static variables
+static aot_options_s options = {.enabled = false, .directory = NULL, .compiler = NULL};
+static uint temporary_count = 0;
+
+// Everything the generated code needs, it includes nothing but the freestanding
+// headers. Fast paths are inlined, anything unusual calls the same value.c
+// function the interpreter does, so both always agree on the result.
+static const char prologue[] =
+	"#include <stdbool.h>\n"
+	"#include <stdint.h>\n"
+	"\n"
+	"typedef struct {\n"
+	"	int type;\n"
+	"	union { bool boolean; double number; int64_t integer; } as;\n"
+	"} value_t;\n"
+	"\n"
+	"typedef struct {\n"
+	"	value_t (*arithmetic[4])(value_t, value_t);\n"
+	"	value_t (*negate)(value_t);\n"
+	"	int (*compare)(value_t, value_t);\n"
+	"	bool (*equal)(value_t, value_t);\n"
+	"	void (*print)(value_t);\n"
+	"	void (*error)(unsigned, const char*);\n"
+	"	void* natives[];\n"
+	"} host_s;\n"
+	"\n"
+	"enum { T_NIL, T_BOOL, T_NUMBER, T_INT };\n"
+	"#define NIL ((value_t){T_NIL, {.integer = 0}})\n"
+	"#define FAIL(line, message) do { h->error(line, message); return false; } while(0)\n"
+	"\n"
+	"static inline value_t boolean(bool b) { return (value_t){T_BOOL, {.boolean = b}}; }\n"
+	"static inline value_t number(double d) { return (value_t){T_NUMBER, {.number = d}}; }\n"
+	"static inline value_t integer(int64_t i) { return (value_t){T_INT, {.integer = i}}; }\n"
+	"static inline bool falsey(value_t v) { return v.type == T_NIL || (v.type == T_BOOL && !v.as.boolean); }\n"
+	"static inline bool numeric(value_t v) { return v.type == T_NUMBER || v.type == T_INT; }\n"
+	"static inline double to_float(value_t v) { return v.type == T_INT ? (double)v.as.integer : v.as.number; }\n"
+	"\n"
+	"#define ARITHMETIC(name, sign, overflows, index)												\\\n"
+	"static inline bool name(const host_s* h, value_t* r, value_t a, value_t b) {						\\\n"
+	"	if(a.type == T_NUMBER && b.type == T_NUMBER) { *r = number(a.as.number sign b.as.number); return true; }	\\\n"
+	"	int64_t i;																					\\\n"
+	"	if(a.type == T_INT && b.type == T_INT && !overflows(a.as.integer, b.as.integer, &i)) {		\\\n"
+	"		*r = integer(i);																		\\\n"
+	"		return true;																			\\\n"
+	"	}																							\\\n"
+	"	if(!numeric(a) || !numeric(b)) return false;												\\\n"
+	"	*r = h->arithmetic[index](a, b);															\\\n"
+	"	return true;																				\\\n"
+	"}\n"
+	"ARITHMETIC(add, +, __builtin_add_overflow, 0)\n"
+	"ARITHMETIC(subtract, -, __builtin_sub_overflow, 1)\n"
+	"ARITHMETIC(multiply, *, __builtin_mul_overflow, 2)\n"
+	"\n"
+	"static inline bool divide(const host_s* h, value_t* r, value_t a, value_t b) {\n"
+	"	if(a.type == T_NUMBER && b.type == T_NUMBER) { *r = number(a.as.number / b.as.number); return true; }\n"
+	"	if(!numeric(a) || !numeric(b)) return false;\n"
+	"	*r = h->arithmetic[3](a, b);\n"
+	"	return true;\n"
+	"}\n"
+	"\n"
+	"static inline bool negate(const host_s* h, value_t* r, value_t a) {\n"
+	"	if(a.type == T_NUMBER) { *r = number(-a.as.number); return true; }\n"
+	"	if(a.type != T_INT) return false;\n"
+	"	*r = h->negate(a);\n"
+	"	return true;\n"
+	"}\n"
+	"\n"
+	"#define COMPARISON(name, sign)																	\\\n"
+	"static inline bool name(const host_s* h, bool* holds, value_t a, value_t b) {					\\\n"
+	"	if(a.type == T_INT && b.type == T_INT) { *holds = a.as.integer sign b.as.integer; return true; }	\\\n"
+	"	if(a.type == T_NUMBER && b.type == T_NUMBER) { *holds = a.as.number sign b.as.number; return true; }	\\\n"
+	"	if(!numeric(a) || !numeric(b)) return false;												\\\n"
+	"	int order = h->compare(a, b);																\\\n"
+	"	*holds = order != 2 && order sign 0;														\\\n"
+	"	return true;																				\\\n"
+	"}\n"
+	"COMPARISON(less, <)\n"
+	"COMPARISON(less_equal, <=)\n"
+	"COMPARISON(greater, >)\n"
+	"COMPARISON(greater_equal, >=)\n"
+	"\n"
+	"static inline bool equal(const host_s* h, value_t a, value_t b) {\n"
+	"	if(a.type == T_NUMBER && b.type == T_NUMBER) return a.as.number == b.as.number;\n"
+	"	if(a.type == T_INT && b.type == T_INT) return a.as.integer == b.as.integer;\n"
+	"	return h->equal(a, b);\n"
+	"}\n"
+	"\n";
+
+//////////// static functions
+static void emit(source_s*, const char*, ...) __attribute__((format(printf, 2, 3)));
+static bool translate(source_s*, chunk_s*);
+static bool translate_chunk(source_s*, chunk_s*, chunk_s*, const int, const uint);
+static void emit_value(source_s*, const value_t);
+static void emit_arguments(source_s*, const uint, const uint);
+static bool find_directory(char*, const size_t);
+static bool build(const char*, const char*, const char*, const char*, const uint64_t);
+static bool same_text(const char*, const char*, const size_t);
+static uint64_t hash_text(const char*, const size_t);
+static void print_line(const value_t);
+static void report_error(const uint, const char*);
+
+//////////// implementations
+void set_aot_options(const aot_options_s _options)
+{
+	options = _options;
+}
+
+aot_options_s get_aot_options()
+{
+	return options;
+}
+
+aot_program_s* aot_load(chunk_s* _script)
+{
+	source_s source = {NULL, 0, 0};
+	if(!translate(&source, _script)) {
+		FREE_ARRAY(char, source.data, source.capacity, MEMORY_SCRATCH);
+		return NULL;
+	}
+
+	char directory[4096];
+	char object[4096 + 32];
+	char text[4096 + 32];
+	if(!find_directory(directory, sizeof(directory))) {
+		FREE_ARRAY(char, source.data, source.capacity, MEMORY_SCRATCH);
+		return NULL;
+	}
+	// the generated text stands for everything that shaped it - the
+	// program, the native signatures and this translator. The hash only
+	// names the files, the text kept next to the object is what decides.
+	const uint64_t hash = hash_text(source.data, source.size);
+	snprintf(object, sizeof(object), "%s/%016" PRIx64 ".so", directory, hash);
+	snprintf(text, sizeof(text), "%s/%016" PRIx64 ".c", directory, hash);
+
+	void* library = NULL;
+	if(same_text(text, source.data, source.size) || build(source.data, directory, object, text, hash)) {
+		library = dlopen(object, RTLD_NOW | RTLD_LOCAL);
+	}
+	FREE_ARRAY(char, source.data, source.capacity, MEMORY_SCRATCH);
+
+	if(!library) {
+		fprintf(stderr, "aot: no native code for this program, interpreting it\n");
+		return NULL;
+	}
+
+	aot_entry_t entry = (aot_entry_t)dlsym(library, "aot_script");
+	if(!entry) {
+		fprintf(stderr, "aot: %s has no entry point\n", object);
+		dlclose(library);
+		return NULL;
+	}
+
+	aot_program_s* program = ALLOCATE(aot_program_s, 1, MEMORY_HANDLES);
+	program->library = library;
+	program->entry = entry;
+	program->host.arithmetic[0] = add_values;
+	program->host.arithmetic[1] = subtract_values;
+	program->host.arithmetic[2] = multiply_values;
+	program->host.arithmetic[3] = divide_values;
+	program->host.negate  = negate_value;
+	program->host.compare = compare_values;
+	program->host.equal	  = values_equal;
+	program->host.print	  = print_line;
+	program->host.error	  = report_error;
+	for(uint i = 0; i < NATIVES_MAX; ++i) {
+		program->host.natives[i] = i < native_count ? (void*)natives[i].as.generic : NULL;
+	}
+	return program;
+}
+
+void aot_free(aot_program_s* _program)
+{
+	if(!_program) return;
+	dlclose(_program->library);
+	FREE(aot_program_s, _program, MEMORY_HANDLES);
+}
+
+interpret_result_e aot_run(const aot_program_s* _program, const value_t* _inputs, value_t* _result)
+{
+	return _program->entry(&_program->host, _inputs, _result) ? INTERPRETER_OK : INTERPRETER_RUNTIME_ERROR;
+}
+
+//////////// static implementations
+static void emit(source_s* _source, const char* _format, ...)
+{
+	va_list arguments;
+	while(true) {
+		const size_t left = _source->capacity - _source->size;
+		va_start(arguments, _format);
+		const int length = vsnprintf(_source->data + _source->size, left, _format, arguments);
+		va_end(arguments);
+
+		if((size_t)length < left) {
+			_source->size += (size_t)length;
+			return;
+		}
+		const size_t capacity = _source->capacity * 2 + (size_t)length + 1;
+		_source->data = GROW_ARRAY(char, _source->data, _source->capacity, capacity, MEMORY_SCRATCH);
+		_source->capacity = capacity;
+	}
+}
+
+static bool translate(source_s* _source, chunk_s* _script)
+{
+	const functions_array_s* functions = &_script->functions;
+
+	emit(_source, "%s", prologue);
+	emit(_source, "_Static_assert(sizeof(value_t) == %zu, \"value_t layout\");\n\n", sizeof(value_t));
+	for(uint i = 0; i < functions->size; ++i) {
+		emit(_source, "static bool f%u(const host_s* h, const value_t* in, unsigned depth, value_t* out", i);
+		for(uint argument = 0; argument < functions->data[i]->arity; ++argument) {
+			emit(_source, ", value_t a%u", argument);
+		}
+		emit(_source, ");\n");
+	}
+	emit(_source, "\n");
+
+	if(!translate_chunk(_source, _script, _script, -1, 0)) return false;
+	for(uint i = 0; i < functions->size; ++i) {
+		// native code has no way back into the compiler, lazy bodies are all compiled now
+		chunk_s* body = functions->data[i]->lazy ? compile_function(_script, functions->data[i]) : &functions->data[i]->chunk;
+		if(!body || !translate_chunk(_source, body, _script, (int)i, functions->data[i]->arity)) return false;
+	}
+	return true;
+}
+
+// The verifier proves every instruction starts at one fixed stack depth, so
+// the slot an instruction touches is known here and each one becomes a
+// variable: s0 is the frame base, the top is s<depth - 1>. The C compiler
+// keeps them in registers and no stack pointer is left at run time.
+static bool translate_chunk(source_s* _source, chunk_s* _chunk, chunk_s* _script, const int _index, const uint _arity)
+{
+	int* depths = ALLOCATE(int, _chunk->size, MEMORY_SCRATCH);
+	verify_report_s report = verify_chunk_depths(_chunk, _script, _arity, depths);
+	if(report.result != VERIFY_OK) {
+		fprintf(stderr, "aot: chunk does not verify: %s\n", verify_result_message(report.result));
+		FREE_ARRAY(int, depths, _chunk->size, MEMORY_SCRATCH);
+		return false;
+	}
+
+	bool* targets = (bool*)allocate_zeroed(sizeof(bool) * _chunk->size, MEMORY_SCRATCH);
+	for(uint offset = 0; offset < _chunk->size; ++offset) {
+		if(depths[offset] == -1) continue;
+		const uint8_t opcode = _chunk->data[offset];
+		const uint next = offset + 3;
+		if(opcode == OP_JUMP || (opcode >= OP_JUMP_IF_FALSE && opcode <= OP_JUMP_IF_NOT_GREATER_EQUAL)) {
+			targets[next + ((_chunk->data[offset + 1] << 8) | _chunk->data[offset + 2])] = true;
+		} else if(opcode == OP_LOOP) {
+			targets[next - ((_chunk->data[offset + 1] << 8) | _chunk->data[offset + 2])] = true;
+		} else if(opcode == OP_TAIL_CALL && _chunk->data[offset + 1] == _index) {
+			targets[0] = true;
+		}
+	}
+
+	if(_index == -1) {
+		emit(_source, "bool aot_script(const host_s* h, const value_t* in, value_t* out)\n{\n");
+		emit(_source, "\tconst unsigned depth = 1;\n");
+	} else {
+		emit(_source, "static bool f%d(const host_s* h, const value_t* in, unsigned depth, value_t* out", _index);
+		for(uint argument = 0; argument < _arity; ++argument) emit(_source, ", value_t a%u", argument);
+		emit(_source, ")\n{\n");
+	}
+	for(uint slot = 0; slot < _chunk->stack_depth; ++slot) {
+		if(slot < _arity) emit(_source, "\tvalue_t s%u = a%u;\n", slot, slot);
+		else emit(_source, "\tvalue_t s%u = NIL;\n", slot);
+	}
+
+	uint offset = 0;
+	while(offset < _chunk->size) {
+		const uint8_t opcode = _chunk->data[offset];
+		const uint line = _chunk->lines[offset];
+		const int depth = depths[offset];
+		const uint8_t operand = offset + 1 < _chunk->size ? _chunk->data[offset + 1] : 0;
+		const uint16_t jump = offset + 2 < _chunk->size ? (uint16_t)((_chunk->data[offset + 1] << 8) | _chunk->data[offset + 2]) : 0;
+		const int top = depth - 1;
+		uint length = 1;
+
+		switch(opcode) {
+			case OP_CONSTANT:
+			case OP_GET_LOCAL:
+			case OP_SET_LOCAL:
+			case OP_GET_INPUT:
+			case OP_CALL_NATIVE_1:
+			case OP_CALL_NATIVE_2:
+			case OP_PICK:
+			case OP_SLIDE:
+			case OP_ARRAY:
+				length = 2;
+				break;
+			case OP_RETURN: case OP_ADD: case OP_SUBTRACT: case OP_MULTIPLY: case OP_DIVIDE: case OP_NEGATION:
+			case OP_NIL: case OP_TRUE: case OP_FALSE:
+			case OP_ADD_NUM_NUM: case OP_SUBTRACT_NUM_NUM: case OP_MULTIPLY_NUM_NUM: case OP_DIVIDE_NUM_NUM:
+			case OP_ADD_INT_INT: case OP_SUBTRACT_INT_INT: case OP_MULTIPLY_INT_INT:
+			case OP_NOT: case OP_EQUAL: case OP_NOT_EQUAL:
+			case OP_LESS: case OP_LESS_EQUAL: case OP_GREATER: case OP_GREATER_EQUAL:
+			case OP_POP: case OP_PRINT: case OP_ARRAY_FILL: case OP_INDEX:
+				length = 1;
+				break;
+			default:
+				length = 3;
+				break;
+		}
+
+		if(targets[offset]) emit(_source, "L%u: ;\n", offset);
+		if(depth == -1) {
+			offset += length;
+			continue;
+		}
+
+		switch(opcode) {
+			case OP_RETURN:
+				emit(_source, "\t*out = s%d;\n\treturn true;\n", top);
+				break;
+			case OP_CONSTANT:
+				emit(_source, "\ts%d = ", depth);
+				emit_value(_source, _chunk->literals.data[operand]);
+				emit(_source, ";\n");
+				break;
+			case OP_NIL:   emit(_source, "\ts%d = NIL;\n", depth);			 break;
+			case OP_TRUE:  emit(_source, "\ts%d = boolean(true);\n", depth);  break;
+			case OP_FALSE: emit(_source, "\ts%d = boolean(false);\n", depth); break;
+			// quickening is an interpreter matter, the C compiler sees the
+			// type tests of the generic form and lays them out itself
+			case OP_ADD:
+			case OP_ADD_NUM_NUM:
+			case OP_ADD_INT_INT:
+			case OP_SUBTRACT:
+			case OP_SUBTRACT_NUM_NUM:
+			case OP_SUBTRACT_INT_INT:
+			case OP_MULTIPLY:
+			case OP_MULTIPLY_NUM_NUM:
+			case OP_MULTIPLY_INT_INT:
+			case OP_DIVIDE:
+			case OP_DIVIDE_NUM_NUM: {
+				const char* function = "divide";
+				if(opcode == OP_ADD || opcode == OP_ADD_NUM_NUM || opcode == OP_ADD_INT_INT) function = "add";
+				else if(opcode == OP_SUBTRACT || opcode == OP_SUBTRACT_NUM_NUM || opcode == OP_SUBTRACT_INT_INT) function = "subtract";
+				else if(opcode == OP_MULTIPLY || opcode == OP_MULTIPLY_NUM_NUM || opcode == OP_MULTIPLY_INT_INT) function = "multiply";
+				emit(_source, "\tif(!%s(h, &s%d, s%d, s%d)) FAIL(%u, \"operands must be numbers\");\n",
+					 function, top - 1, top - 1, top, line);
+				break;
+			}
+			case OP_NEGATION:
+				emit(_source, "\tif(!negate(h, &s%d, s%d)) FAIL(%u, \"operand must be a number\");\n", top, top, line);
+				break;
+			case OP_NOT:
+				emit(_source, "\ts%d = boolean(falsey(s%d));\n", top, top);
+				break;
+			case OP_EQUAL:
+			case OP_NOT_EQUAL:
+				emit(_source, "\ts%d = boolean(%sequal(h, s%d, s%d));\n",
+					 top - 1, opcode == OP_EQUAL ? "" : "!", top - 1, top);
+				break;
+			case OP_LESS:
+			case OP_LESS_EQUAL:
+			case OP_GREATER:
+			case OP_GREATER_EQUAL: {
+				static const char* comparisons[] = {"less", "less_equal", "greater", "greater_equal"};
+				emit(_source, "\t{ bool holds; if(!%s(h, &holds, s%d, s%d)) FAIL(%u, \"operands must be numbers\"); s%d = boolean(holds); }\n",
+					 comparisons[opcode - OP_LESS], top - 1, top, line, top - 1);
+				break;
+			}
+			case OP_POP:
+				break;
+			case OP_PRINT:
+				emit(_source, "\th->print(s%d);\n", top);
+				break;
+			case OP_GET_LOCAL:
+				emit(_source, "\ts%d = s%u;\n", depth, operand);
+				break;
+			case OP_SET_LOCAL:
+				emit(_source, "\ts%u = s%d;\n", operand, top);
+				break;
+			case OP_GET_INPUT:
+				emit(_source, "\ts%d = in[%u];\n", depth, operand);
+				break;
+			case OP_PICK:
+				emit(_source, "\ts%d = s%d;\n", depth, top - operand);
+				break;
+			case OP_SLIDE:
+				emit(_source, "\ts%d = s%d;\n", top - operand, top);
+				break;
+			case OP_JUMP:
+				emit(_source, "\tgoto L%u;\n", offset + 3 + jump);
+				break;
+			case OP_LOOP:
+				emit(_source, "\tgoto L%u;\n", offset + 3 - jump);
+				break;
+			case OP_JUMP_IF_FALSE:
+			case OP_JUMP_IF_FALSE_OR_POP:
+				emit(_source, "\tif(falsey(s%d)) goto L%u;\n", top, offset + 3 + jump);
+				break;
+			case OP_JUMP_IF_TRUE_OR_POP:
+				emit(_source, "\tif(!falsey(s%d)) goto L%u;\n", top, offset + 3 + jump);
+				break;
+			case OP_JUMP_IF_NOT_EQUAL:
+			case OP_JUMP_IF_EQUAL:
+				emit(_source, "\tif(%sequal(h, s%d, s%d)) goto L%u;\n",
+					 opcode == OP_JUMP_IF_NOT_EQUAL ? "!" : "", top - 1, top, offset + 3 + jump);
+				break;
+			case OP_JUMP_IF_NOT_LESS:
+			case OP_JUMP_IF_NOT_LESS_EQUAL:
+			case OP_JUMP_IF_NOT_GREATER:
+			case OP_JUMP_IF_NOT_GREATER_EQUAL: {
+				static const char* comparisons[] = {"less", "less_equal", "greater", "greater_equal"};
+				emit(_source, "\t{ bool holds; if(!%s(h, &holds, s%d, s%d)) FAIL(%u, \"operands must be numbers\"); if(!holds) goto L%u; }\n",
+					 comparisons[opcode - OP_JUMP_IF_NOT_LESS], top - 1, top, line, offset + 3 + jump);
+				break;
+			}
+			case OP_CALL: {
+				const uint8_t count = _chunk->data[offset + 2];
+				emit(_source, "\tif(depth == %u) FAIL(%u, \"stack overflow\");\n", FRAMES_MAX, line);
+				emit(_source, "\tif(!f%u(h, in, depth + 1, &s%d", operand, depth - count);
+				for(uint argument = 0; argument < count; ++argument) emit(_source, ", s%d", depth - count + argument);
+				emit(_source, ")) return false;\n");
+				break;
+			}
+			case OP_TAIL_CALL: {
+				const uint8_t count = _chunk->data[offset + 2];
+				if(operand == _index) {
+					// a loop in all but name, the arguments become the new frame
+					emit(_source, "\t{\n");
+					for(uint argument = 0; argument < count; ++argument) {
+						emit(_source, "\t\tvalue_t t%u = s%d;\n", argument, depth - count + argument);
+					}
+					for(uint argument = 0; argument < count; ++argument) emit(_source, "\t\ts%u = t%u;\n", argument, argument);
+					emit(_source, "\t\tgoto L0;\n\t}\n");
+				} else {
+					// a C return f(...) only runs in constant stack if the C
+					// compiler makes it a jump, and nothing guarantees that
+					fprintf(stderr, "aot: the program has tail calls between functions, interpreting it\n");
+					FREE_ARRAY(int, depths, _chunk->size, MEMORY_SCRATCH);
+					FREE_ARRAY(bool, targets, _chunk->size, MEMORY_SCRATCH);
+					return false;
+				}
+				break;
+			}
+			case OP_CALL_NATIVE: {
+				const uint8_t count = _chunk->data[offset + 2];
+				emit_arguments(_source, (uint)(depth - count), count);
+				emit(_source, "\t\tif(!((bool (*)(value_t*, value_t*))h->natives[%u])(arguments, &s%d)) FAIL(%u, \"native function failed\");\n\t}\n",
+					 operand, depth - count, line);
+				break;
+			}
+			case OP_CALL_NATIVE_1:
+				emit(_source, "\tif(!numeric(s%d)) FAIL(%u, \"argument must be a number\");\n", top, line);
+				emit(_source, "\ts%d = number(((double (*)(double))h->natives[%u])(to_float(s%d)));\n", top, operand, top);
+				break;
+			case OP_CALL_NATIVE_2:
+				emit(_source, "\tif(!numeric(s%d) || !numeric(s%d)) FAIL(%u, \"arguments must be numbers\");\n", top - 1, top, line);
+				emit(_source, "\ts%d = number(((double (*)(double, double))h->natives[%u])(to_float(s%d), to_float(s%d)));\n",
+					 top - 1, operand, top - 1, top);
+				break;
+			// arrays live in the heap of a vm and native code has none. Only
+			// a literal makes one, so without them there are no arrays at all
+			case OP_ARRAY:
+			case OP_ARRAY_FILL:
+				fprintf(stderr, "aot: the program makes arrays, interpreting it\n");
+				FREE_ARRAY(int, depths, _chunk->size, MEMORY_SCRATCH);
+				FREE_ARRAY(bool, targets, _chunk->size, MEMORY_SCRATCH);
+				return false;
+			case OP_INDEX:
+				emit(_source, "\tFAIL(%u, \"only arrays can be indexed\");\n", line);
+				break;
+			default:
+				fprintf(stderr, "aot: can't translate opcode %d\n", opcode);
+				FREE_ARRAY(int, depths, _chunk->size, MEMORY_SCRATCH);
+				FREE_ARRAY(bool, targets, _chunk->size, MEMORY_SCRATCH);
+				return false;
+		}
+		offset += length;
+	}
+	emit(_source, "}\n\n");
+
+	FREE_ARRAY(int, depths, _chunk->size, MEMORY_SCRATCH);
+	FREE_ARRAY(bool, targets, _chunk->size, MEMORY_SCRATCH);
+	return true;
+}
+
+// exact round trip: doubles as hex floats, ints as written
+static void emit_value(source_s* _source, const value_t _value)
+{
+	switch(_value.type) {
+		case VAL_NIL:  emit(_source, "NIL"); break;
+		case VAL_BOOL: emit(_source, "boolean(%s)", AS_BOOL(_value) ? "true" : "false"); break;
+		case VAL_INT:
+			if(AS_INT(_value) == INT64_MIN) emit(_source, "integer(INT64_MIN)");
+			else emit(_source, "integer(INT64_C(%" PRId64 "))", AS_INT(_value));
+			break;
+		case VAL_NUMBER:
+			if(isnan(AS_NUMBER(_value))) emit(_source, "number(__builtin_nan(\"\"))");
+			else if(isinf(AS_NUMBER(_value))) emit(_source, "number(%s__builtin_inf())", AS_NUMBER(_value) < 0 ? "-" : "");
+			else emit(_source, "number(%a)", AS_NUMBER(_value));
+			break;
+		case VAL_ARRAY:	// constants are never arrays, they are made at run time
+			emit(_source, "NIL");
+			break;
+	}
+}
+
+// natives take their arguments as an array, the slots are copied into one
+static void emit_arguments(source_s* _source, const uint _first, const uint _count)
+{
+	emit(_source, "\t{\n\t\tvalue_t arguments[%u] = {", _count == 0 ? 1 : _count);
+	for(uint argument = 0; argument < _count; ++argument) {
+		emit(_source, "%ss%u", argument == 0 ? "" : ", ", _first + argument);
+	}
+	emit(_source, "};\n");
+}
+
+// the objects are loaded into this process, so the directory must not be
+// writable by anyone else
+static bool find_directory(char* _directory, const size_t _size)
+{
+	if(options.directory) {
+		snprintf(_directory, _size, "%s", options.directory);
+	} else {
+		const char* temporary = getenv("TMPDIR");
+		snprintf(_directory, _size, "%s/interpreter-aot", temporary && *temporary ? temporary : "/tmp");
+	}
+
+	if(mkdir(_directory, 0700) != 0 && errno != EEXIST) {
+		fprintf(stderr, "aot: can't create %s: %s\n", _directory, strerror(errno));
+		return false;
+	}
+
+	struct stat status;
+	if(stat(_directory, &status) != 0 || !S_ISDIR(status.st_mode)) {
+		fprintf(stderr, "aot: %s is not a directory\n", _directory);
+		return false;
+	}
+	if(status.st_uid != getuid() || (status.st_mode & (S_IWGRP | S_IWOTH))) {
+		fprintf(stderr, "aot: %s is writable by other users, not loading code from it\n", _directory);
+		return false;
+	}
+	return true;
+}
+
+// writes the C next to the object and compiles it under a name of its own,
+// the renames publish both at once, so processes building the same program
+// at the same time never load half an object. The text goes last, it is
+// what vouches for the object.
+static bool build(const char* _text, const char* _directory, const char* _object, const char* _kept, const uint64_t _hash)
+{
+	char source_path[4096 + 64];
+	char object_path[4096 + 64];
+	const uint unique = __atomic_add_fetch(&temporary_count, 1, __ATOMIC_RELAXED);
+	snprintf(source_path, sizeof(source_path), "%s/%016" PRIx64 "-%d-%u.c", _directory, _hash, (int)getpid(), unique);
+	snprintf(object_path, sizeof(object_path), "%s/%016" PRIx64 "-%d-%u.so", _directory, _hash, (int)getpid(), unique);
+
+	FILE* file = fopen(source_path, "w");
+	if(!file) {
+		fprintf(stderr, "aot: can't write %s: %s\n", source_path, strerror(errno));
+		return false;
+	}
+	fputs(_text, file);
+	fclose(file);
+
+	const char* compiler = options.compiler;
+	if(!compiler) compiler = getenv("CC");
+	if(!compiler || !*compiler) compiler = "cc";
+
+	// the child must not flush what the script printed a second time
+	fflush(stdout);
+	fflush(stderr);
+	pid_t child = fork();
+	if(child == 0) {
+		// nothing of the compiler's output is of use to a script author
+		const int null = open("/dev/null", O_WRONLY);
+		dup2(null, STDOUT_FILENO);
+		dup2(null, STDERR_FILENO);
+		// the compiler may be several words, "ccache gcc" or "gcc -m64", split
+		// like make's shell would. Only split: no globbing, and the paths
+		// go in as arguments of their own.
+		execl("/bin/sh", "sh", "-c", "set -f; exec $0 -O2 -shared -fPIC -o \"$1\" \"$2\"",
+			  compiler, object_path, source_path, (char*)NULL);
+		_exit(127);
+	}
+
+	int status = 0;
+	bool built = child > 0 && waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+	// an old text must not vouch for the new object, not even for a moment
+	unlink(_kept);
+	if(built && rename(object_path, _object) != 0) built = false;
+	if(built && rename(source_path, _kept) != 0) built = false;
+	if(!built) {
+		unlink(source_path);
+		unlink(object_path);
+		fprintf(stderr, "aot: %s could not build the program\n", compiler);
+	}
+	return built;
+}
+
+// whether the file holds exactly the text, a missing file doesn't
+static bool same_text(const char* _path, const char* _text, const size_t _size)
+{
+	FILE* file = fopen(_path, "rb");
+	if(!file) return false;
+
+	char buffer[4096];
+	size_t compared = 0;
+	bool same = true;
+	while(same) {
+		const size_t read = fread(buffer, 1, sizeof(buffer), file);
+		if(read == 0) break;
+		same = compared + read <= _size && memcmp(buffer, _text + compared, read) == 0;
+		compared += read;
+	}
+	same = same && !ferror(file) && compared == _size;
+	fclose(file);
+	return same;
+}
+
+// FNV-1a, same as the program cache
+static uint64_t hash_text(const char* _text, const size_t _length)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for(size_t i = 0; i < _length; ++i) {
+		hash ^= (uint8_t)_text[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+static void print_line(const value_t _value)
+{
+	print_value(_value);
+	printf("\n");
+}
+
+static void report_error(const uint _line, const char* _message)
+{
+	fprintf(stderr, "[line %d] Runtime error: %s\n", _line, _message);
+}
@@ -0,0 +1,319 @@
+#include "../include/array.h"
+#include "../include/memory.h"
+
+#include <math.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define ARRAY_AVX2
+#include <immintrin.h>
+#endif
+
+// the elements start at the first boundary behind the header
+#define ARRAY_HEADER ARRAY_ALIGNMENT
+_Static_assert(sizeof(array_s) <= ARRAY_HEADER, "array header doesn't fit in front of the elements");
+
+//////////// static functions
+static bool has_avx2();
+static void apply_scalar(const array_operation_e, double*, const double*, const uint, const double*, const uint, const uint);
+static double sum_lanes(const double*);
+static double min_lanes(const double*);
+static double max_lanes(const double*);
+static bool contains(const double*, const uint, const double);
+#ifdef ARRAY_AVX2
+static void apply_avx2(const array_operation_e, double*, const double*, const uint, const double*, const uint, const uint);
+static void negate_avx2(double*, const double*, const uint);
+static void sum_avx2(const double*, const uint, double*);
+static void dot_avx2(const double*, const double*, const uint, double*);
+static void min_avx2(const double*, const uint, double*);
+static void max_avx2(const double*, const uint, double*);
+#endif
+
+//////////// implementations
+array_s* new_array(const uint _length)
+{
+	array_s* array = (array_s*)allocate_aligned(array_size(_length), ARRAY_ALIGNMENT, MEMORY_OBJECTS);
+	array->next	  = NULL;
+	array->length = _length;
+	array->marked = false;
+	array->data	  = (double*)((char*)array + ARRAY_HEADER);
+	return array;
+}
+
+void free_array(array_s* _array)
+{
+	free_aligned(_array, array_size(_array->length), MEMORY_OBJECTS);
+}
+
+size_t array_size(const uint _length)
+{
+	const size_t elements = (size_t)_length * sizeof(double);
+	return ARRAY_HEADER + ((elements + ARRAY_ALIGNMENT - 1) & ~(size_t)(ARRAY_ALIGNMENT - 1));
+}
+
+void print_array(const array_s* _array)
+{
+	printf("[");
+	for(uint i = 0; i < _array->length; ++i) {
+		printf(i == 0 ? "%g" : ", %g", _array->data[i]);
+	}
+	printf("]");
+}
+
+bool arrays_equal(const array_s* _a, const array_s* _b)
+{
+	if(_a->length != _b->length) return false;
+	for(uint i = 0; i < _a->length; ++i) {
+		if(_a->data[i] != _b->data[i]) return false;
+	}
+	return true;
+}
+
+void array_apply(const array_operation_e _operation, double* _result, const double* _a, const uint _a_step,
+				 const double* _b, const uint _b_step, const uint _length)
+{
+	assert(_a_step == 1 || _b_step == 1);
+#ifdef ARRAY_AVX2
+	if(has_avx2()) {
+		apply_avx2(_operation, _result, _a, _a_step, _b, _b_step, _length);
+		return;
+	}
+#endif
+	apply_scalar(_operation, _result, _a, _a_step, _b, _b_step, _length);
+}
+
+void array_negate(double* _result, const double* _a, const uint _length)
+{
+	uint i = 0;
+#ifdef ARRAY_AVX2
+	if(has_avx2()) {
+		negate_avx2(_result, _a, _length);
+		i = _length & ~3u;
+	}
+#endif
+	for(; i < _length; ++i) _result[i] = -_a[i];
+}
+
+double array_sum(const double* _a, const uint _length)
+{
+	double lanes[4] = {0, 0, 0, 0};
+	uint i = 0;
+#ifdef ARRAY_AVX2
+	if(has_avx2()) {
+		sum_avx2(_a, _length, lanes);
+		i = _length & ~3u;
+	}
+#endif
+	for(; i + 4 <= _length; i += 4) {
+		for(uint lane = 0; lane < 4; ++lane) lanes[lane] += _a[i + lane];
+	}
+
+	double sum = sum_lanes(lanes);
+	for(; i < _length; ++i) sum += _a[i];
+	return sum;
+}
+
+double array_dot(const double* _a, const double* _b, const uint _length)
+{
+	double lanes[4] = {0, 0, 0, 0};
+	uint i = 0;
+#ifdef ARRAY_AVX2
+	if(has_avx2()) {
+		dot_avx2(_a, _b, _length, lanes);
+		i = _length & ~3u;
+	}
+#endif
+	for(; i + 4 <= _length; i += 4) {
+		for(uint lane = 0; lane < 4; ++lane) lanes[lane] += _a[i + lane] * _b[i + lane];
+	}
+
+	double sum = sum_lanes(lanes);
+	for(; i < _length; ++i) sum += _a[i] * _b[i];
+	return sum;
+}
+
+// x < lowest ? x : lowest is what _mm256_min_pd() does, a NaN never wins
+double array_min(const double* _a, const uint _length)
+{
+	double lanes[4] = {INFINITY, INFINITY, INFINITY, INFINITY};
+	uint i = 0;
+#ifdef ARRAY_AVX2
+	if(has_avx2()) {
+		min_avx2(_a, _length, lanes);
+		i = _length & ~3u;
+	}
+#endif
+	for(; i + 4 <= _length; i += 4) {
+		for(uint lane = 0; lane < 4; ++lane) lanes[lane] = _a[i + lane] < lanes[lane] ? _a[i + lane] : lanes[lane];
+	}
+
+	double lowest = min_lanes(lanes);
+	for(; i < _length; ++i) lowest = _a[i] < lowest ? _a[i] : lowest;
+	if(lowest == INFINITY && !contains(_a, _length, INFINITY)) return NAN;
+	return lowest;
+}
+
+double array_max(const double* _a, const uint _length)
+{
+	double lanes[4] = {-INFINITY, -INFINITY, -INFINITY, -INFINITY};
+	uint i = 0;
+#ifdef ARRAY_AVX2
+	if(has_avx2()) {
+		max_avx2(_a, _length, lanes);
+		i = _length & ~3u;
+	}
+#endif
+	for(; i + 4 <= _length; i += 4) {
+		for(uint lane = 0; lane < 4; ++lane) lanes[lane] = _a[i + lane] > lanes[lane] ? _a[i + lane] : lanes[lane];
+	}
+
+	double highest = max_lanes(lanes);
+	for(; i < _length; ++i) highest = _a[i] > highest ? _a[i] : highest;
+	if(highest == -INFINITY && !contains(_a, _length, -INFINITY)) return NAN;
+	return highest;
+}
+
+const char* array_kernels()
+{
+	return has_avx2() ? "avx2" : "scalar";
+}
+
+//////////// static implementations
+// libgcc reads cpuid once at startup, this is a load and a test
+static bool has_avx2()
+{
+#ifdef ARRAY_AVX2
+	return __builtin_cpu_supports("avx2");
+#else
+	return false;
+#endif
+}
+
+static void apply_scalar(const array_operation_e _operation, double* _result, const double* _a, const uint _a_step,
+						 const double* _b, const uint _b_step, const uint _length)
+{
+	switch(_operation) {
+		case ARRAY_ADD:
+			for(uint i = 0; i < _length; ++i) _result[i] = _a[i * _a_step] + _b[i * _b_step];
+			break;
+		case ARRAY_SUBTRACT:
+			for(uint i = 0; i < _length; ++i) _result[i] = _a[i * _a_step] - _b[i * _b_step];
+			break;
+		case ARRAY_MULTIPLY:
+			for(uint i = 0; i < _length; ++i) _result[i] = _a[i * _a_step] * _b[i * _b_step];
+			break;
+		case ARRAY_DIVIDE:
+			for(uint i = 0; i < _length; ++i) _result[i] = _a[i * _a_step] / _b[i * _b_step];
+			break;
+	}
+}
+
+// the same pairing for every kernel, so avx2 and scalar round alike
+static double sum_lanes(const double* _lanes)
+{
+	return (_lanes[0] + _lanes[1]) + (_lanes[2] + _lanes[3]);
+}
+
+static double min_lanes(const double* _lanes)
+{
+	const double low = _lanes[1] < _lanes[0] ? _lanes[1] : _lanes[0];
+	const double high = _lanes[3] < _lanes[2] ? _lanes[3] : _lanes[2];
+	return high < low ? high : low;
+}
+
+static double max_lanes(const double* _lanes)
+{
+	const double low = _lanes[1] > _lanes[0] ? _lanes[1] : _lanes[0];
+	const double high = _lanes[3] > _lanes[2] ? _lanes[3] : _lanes[2];
+	return high > low ? high : low;
+}
+
+static bool contains(const double* _a, const uint _length, const double _value)
+{
+	for(uint i = 0; i < _length; ++i) {
+		if(_a[i] == _value) return true;
+	}
+	return false;
+}
+
+#ifdef ARRAY_AVX2
+// whole vectors only, the caller does the rest. Array elements are 64 byte
+// aligned, so every load and store at a multiple of four is too.
+#define APPLY_AVX2(vector)	do {																		\
+		if(_a_step && _b_step) {																	\
+			for(; i + 4 <= _length; i += 4) {														\
+				_mm256_store_pd(_result + i, vector(_mm256_load_pd(_a + i), _mm256_load_pd(_b + i)));	\
+			}																						\
+		} else if(_a_step) {																		\
+			const __m256d b = _mm256_set1_pd(*_b);													\
+			for(; i + 4 <= _length; i += 4) {														\
+				_mm256_store_pd(_result + i, vector(_mm256_load_pd(_a + i), b));					\
+			}																						\
+		} else {																					\
+			const __m256d a = _mm256_set1_pd(*_a);													\
+			for(; i + 4 <= _length; i += 4) {														\
+				_mm256_store_pd(_result + i, vector(a, _mm256_load_pd(_b + i)));					\
+			}																						\
+		}																							\
+	}while(0)
+
+__attribute__((target("avx2")))
+static void apply_avx2(const array_operation_e _operation, double* _result, const double* _a, const uint _a_step,
+					   const double* _b, const uint _b_step, const uint _length)
+{
+	uint i = 0;
+	switch(_operation) {
+		case ARRAY_ADD:		 APPLY_AVX2(_mm256_add_pd); break;
+		case ARRAY_SUBTRACT: APPLY_AVX2(_mm256_sub_pd); break;
+		case ARRAY_MULTIPLY: APPLY_AVX2(_mm256_mul_pd); break;
+		case ARRAY_DIVIDE:	 APPLY_AVX2(_mm256_div_pd); break;
+	}
+	apply_scalar(_operation, _result + i, _a + i * _a_step, _a_step, _b + i * _b_step, _b_step, _length - i);
+}
+
+#undef APPLY_AVX2
+
+// flips the sign bit, so -0 and NaN come out like the scalar negation
+__attribute__((target("avx2")))
+static void negate_avx2(double* _result, const double* _a, const uint _length)
+{
+	const __m256d sign = _mm256_set1_pd(-0.0);
+	for(uint i = 0; i + 4 <= _length; i += 4) {
+		_mm256_store_pd(_result + i, _mm256_xor_pd(_mm256_load_pd(_a + i), sign));
+	}
+}
+
+__attribute__((target("avx2")))
+static void sum_avx2(const double* _a, const uint _length, double* _lanes)
+{
+	__m256d sum = _mm256_loadu_pd(_lanes);
+	for(uint i = 0; i + 4 <= _length; i += 4) sum = _mm256_add_pd(sum, _mm256_load_pd(_a + i));
+	_mm256_storeu_pd(_lanes, sum);
+}
+
+// no fma, it would round differently from the scalar loop
+__attribute__((target("avx2")))
+static void dot_avx2(const double* _a, const double* _b, const uint _length, double* _lanes)
+{
+	__m256d sum = _mm256_loadu_pd(_lanes);
+	for(uint i = 0; i + 4 <= _length; i += 4) {
+		sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_load_pd(_a + i), _mm256_load_pd(_b + i)));
+	}
+	_mm256_storeu_pd(_lanes, sum);
+}
+
+__attribute__((target("avx2")))
+static void min_avx2(const double* _a, const uint _length, double* _lanes)
+{
+	__m256d lowest = _mm256_loadu_pd(_lanes);
+	for(uint i = 0; i + 4 <= _length; i += 4) lowest = _mm256_min_pd(_mm256_load_pd(_a + i), lowest);
+	_mm256_storeu_pd(_lanes, lowest);
+}
+
+__attribute__((target("avx2")))
+static void max_avx2(const double* _a, const uint _length, double* _lanes)
+{
+	__m256d highest = _mm256_loadu_pd(_lanes);
+	for(uint i = 0; i + 4 <= _length; i += 4) highest = _mm256_max_pd(_mm256_load_pd(_a + i), highest);
+	_mm256_storeu_pd(_lanes, highest);
+}
+#endif
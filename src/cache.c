@@ -0,0 +1,262 @@
+#include "../include/cache.h"
+
+#include <pthread.h>
+
+#include "../include/memory.h"
+
+//////////// static types
+typedef struct {
+	cache_entry_s** buckets;
+	uint bucket_count;		// power of two
+	cache_entry_s* newest;
+	cache_entry_s* oldest;
+	cache_stats_s stats;
+}cache_s;
+
+//////////// static variables
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static cache_s cache = {.stats.budget = CACHE_DEFAULT_BUDGET};
+
+//////////// static functions
+static uint64_t hash_source(const char*, const size_t, const uint, const bool);
+static cache_entry_s* find(const uint64_t, const char*, const size_t, const uint, const bool);
+static void grow_buckets();
+static void link_newest(cache_entry_s*);
+static void unlink_entry(cache_entry_s*);
+static void remove_from_bucket(cache_entry_s*);
+static void evict_to(const size_t);
+static void remove_oldest();
+static void drop_reference(cache_entry_s*);
+
+//////////// implementations
+void set_cache_budget(const size_t _budget)
+{
+	pthread_mutex_lock(&cache_lock);
+	cache.stats.budget = _budget;
+	evict_to(_budget);
+	pthread_mutex_unlock(&cache_lock);
+}
+
+void free_cache()
+{
+	pthread_mutex_lock(&cache_lock);
+	while(cache.oldest) remove_oldest();
+	FREE_ARRAY(cache_entry_s*, cache.buckets, cache.bucket_count, MEMORY_CACHE);
+	cache.buckets = NULL;
+	cache.bucket_count = 0;
+	pthread_mutex_unlock(&cache_lock);
+}
+
+cache_entry_s* cache_lookup(const char* _source, const uint _optimization_level, const bool _lazy)
+{
+	const size_t length = strlen(_source);
+	const uint64_t hash = hash_source(_source, length, _optimization_level, _lazy);
+
+	pthread_mutex_lock(&cache_lock);
+	cache_entry_s* entry = find(hash, _source, length, _optimization_level, _lazy);
+	if(entry) {
+		++cache.stats.hits;
+		++entry->references;
+		unlink_entry(entry);
+		link_newest(entry);
+	} else {
+		++cache.stats.misses;
+	}
+	pthread_mutex_unlock(&cache_lock);
+	return entry;
+}
+
+cache_entry_s* cache_insert(const char* _source, const uint _optimization_level, const bool _lazy,
+							chunk_s* _chunk, const uint _stack_depth)
+{
+	const size_t length = strlen(_source);
+	const uint64_t hash = hash_source(_source, length, _optimization_level, _lazy);
+
+	pthread_mutex_lock(&cache_lock);
+	cache_entry_s* entry = find(hash, _source, length, _optimization_level, _lazy);
+	if(entry) {
+		++entry->references;
+		pthread_mutex_unlock(&cache_lock);
+		free_chunk(_chunk);
+		return entry;
+	}
+
+	entry = ALLOCATE(cache_entry_s, 1, MEMORY_CACHE);
+	entry->hash = hash;
+	entry->source = ALLOCATE(char, length + 1, MEMORY_CACHE);
+	memcpy(entry->source, _source, length + 1);
+	entry->length = length;
+	entry->optimization_level = _optimization_level;
+	entry->lazy = _lazy;
+	entry->chunk = *_chunk;
+	entry->stack_depth = _stack_depth;
+	entry->native = NULL;
+	entry->native_tried = false;
+	entry->bytes = sizeof(cache_entry_s) + length + 1 + chunk_memory(_chunk);
+	entry->references = 1;
+
+	// too big to ever fit, the caller just gets a private copy
+	if(entry->bytes > cache.stats.budget) {
+		entry->newer = entry->older = entry->next_in_bucket = NULL;
+		pthread_mutex_unlock(&cache_lock);
+		return entry;
+	}
+
+	evict_to(cache.stats.budget - entry->bytes);
+	if(cache.stats.entries >= cache.bucket_count) grow_buckets();
+
+	cache_entry_s** bucket = &cache.buckets[hash & (cache.bucket_count - 1)];
+	entry->next_in_bucket = *bucket;
+	*bucket = entry;
+	link_newest(entry);
+	++entry->references;
+	++cache.stats.entries;
+	cache.stats.bytes += entry->bytes;
+
+	pthread_mutex_unlock(&cache_lock);
+	return entry;
+}
+
+void cache_release(cache_entry_s* _entry)
+{
+	pthread_mutex_lock(&cache_lock);
+	drop_reference(_entry);
+	pthread_mutex_unlock(&cache_lock);
+}
+
+uint cache_collect(cache_entry_s** _entries, const uint _max)
+{
+	pthread_mutex_lock(&cache_lock);
+	uint count = 0;
+	for(cache_entry_s* entry = cache.oldest; entry && count < _max; entry = entry->newer) {
+		++entry->references;
+		_entries[count++] = entry;
+	}
+	pthread_mutex_unlock(&cache_lock);
+	return count;
+}
+
+cache_stats_s cache_stats()
+{
+	pthread_mutex_lock(&cache_lock);
+	cache_stats_s stats = cache.stats;
+	pthread_mutex_unlock(&cache_lock);
+	return stats;
+}
+
+void print_cache_stats(FILE* _file)
+{
+	cache_stats_s stats = cache_stats();
+	fprintf(_file, "cache: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " evictions, "
+			"%u entries, %zu of %zu bytes\n",
+			stats.hits, stats.misses, stats.evictions, stats.entries, stats.bytes, stats.budget);
+}
+
+//////////// static implementations
+
+// FNV-1a, the options are folded in as if they were a prefix
+static uint64_t hash_source(const char* _source, const size_t _length, const uint _optimization_level, const bool _lazy)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	hash ^= _optimization_level;
+	hash *= 1099511628211ULL;
+	hash ^= _lazy;
+	hash *= 1099511628211ULL;
+	for(size_t i = 0; i < _length; ++i) {
+		hash ^= (uint8_t)_source[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static cache_entry_s* find(const uint64_t _hash, const char* _source, const size_t _length,
+						   const uint _optimization_level, const bool _lazy)
+{
+	if(cache.bucket_count == 0) return NULL;
+
+	cache_entry_s* entry = cache.buckets[_hash & (cache.bucket_count - 1)];
+	for(; entry; entry = entry->next_in_bucket) {
+		if(entry->hash == _hash && entry->length == _length
+		   && entry->optimization_level == _optimization_level && entry->lazy == _lazy
+		   && memcmp(entry->source, _source, _length) == 0) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+// keeps the load factor at one entry per bucket at most
+static void grow_buckets()
+{
+	const uint count = cache.bucket_count == 0 ? 64 : cache.bucket_count * 2;
+	cache_entry_s** buckets = (cache_entry_s**)allocate_zeroed(sizeof(cache_entry_s*) * count, MEMORY_CACHE);
+
+	for(uint i = 0; i < cache.bucket_count; ++i) {
+		cache_entry_s* entry = cache.buckets[i];
+		while(entry) {
+			cache_entry_s* next = entry->next_in_bucket;
+			cache_entry_s** bucket = &buckets[entry->hash & (count - 1)];
+			entry->next_in_bucket = *bucket;
+			*bucket = entry;
+			entry = next;
+		}
+	}
+
+	FREE_ARRAY(cache_entry_s*, cache.buckets, cache.bucket_count, MEMORY_CACHE);
+	cache.buckets = buckets;
+	cache.bucket_count = count;
+}
+
+static void link_newest(cache_entry_s* _entry)
+{
+	_entry->older = cache.newest;
+	_entry->newer = NULL;
+	if(cache.newest) cache.newest->newer = _entry;
+	cache.newest = _entry;
+	if(!cache.oldest) cache.oldest = _entry;
+}
+
+static void unlink_entry(cache_entry_s* _entry)
+{
+	if(_entry->newer) _entry->newer->older = _entry->older;
+	else cache.newest = _entry->older;
+	if(_entry->older) _entry->older->newer = _entry->newer;
+	else cache.oldest = _entry->newer;
+	_entry->newer = _entry->older = NULL;
+}
+
+static void remove_from_bucket(cache_entry_s* _entry)
+{
+	cache_entry_s** link = &cache.buckets[_entry->hash & (cache.bucket_count - 1)];
+	while(*link != _entry) link = &(*link)->next_in_bucket;
+	*link = _entry->next_in_bucket;
+	_entry->next_in_bucket = NULL;
+}
+
+static void evict_to(const size_t _bytes)
+{
+	while(cache.oldest && cache.stats.bytes > _bytes) {
+		remove_oldest();
+		++cache.stats.evictions;
+	}
+}
+
+static void remove_oldest()
+{
+	cache_entry_s* entry = cache.oldest;
+	unlink_entry(entry);
+	remove_from_bucket(entry);
+	--cache.stats.entries;
+	cache.stats.bytes -= entry->bytes;
+	drop_reference(entry);
+}
+
+static void drop_reference(cache_entry_s* _entry)
+{
+	if(--_entry->references > 0) return;
+
+	aot_free(_entry->native);
+	free_chunk(&_entry->chunk);
+	FREE_ARRAY(char, _entry->source, _entry->length + 1, MEMORY_CACHE);
+	FREE(cache_entry_s, _entry, MEMORY_CACHE);
+}
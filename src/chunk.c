@@ -1,5 +1,7 @@
 #include "../include/chunk.h"
 
+#include "../include/memory.h"
+
 ////////////////////////////////////////// static functions
 static void realloc_chunk(chunk_s** _chunk);
 
@@ -8,25 +10,53 @@ static void realloc_literals_array(literals_array_s**);
 static void init_literals_array(literals_array_s*);
 static void free_literals_array(literals_array_s*);
 static int append_literals_array(literals_array_s*, const value_t);
+static void init_functions_array(functions_array_s*);
+static void free_functions_array(functions_array_s*);
+static void init_names_array(names_array_s*);
+static void free_names_array(names_array_s*);
 
 ////////////////////////////////////////// implementations
 void init_chunk(chunk_s* _chunk)
 {
 	//TODO: check if aligned_alloc(); can be better here
-	_chunk->data = (uint8_t*)malloc(sizeof(uint8_t) * chunk_init_size);
-	memset(_chunk->data, '\0', chunk_init_size);
-	_chunk->lines = (uint*)malloc(sizeof(uint) * chunk_init_size);
-	memset(_chunk->lines, '\0', chunk_init_size);
+	_chunk->data = (uint8_t*)allocate_zeroed(sizeof(uint8_t) * chunk_init_size, MEMORY_BYTECODE);
+	_chunk->lines = (uint*)allocate_zeroed(sizeof(uint) * chunk_init_size, MEMORY_LINES);
 	_chunk->capacity = chunk_init_size;
 	_chunk->size = 0;
+	_chunk->verified = false;
+	_chunk->stack_depth = 0;
+	_chunk->frame_depth = 0;
 	init_literals_array(&_chunk->literals);
+	init_functions_array(&_chunk->functions);
+	init_names_array(&_chunk->inputs);
+}
+
+void init_stub_chunk(chunk_s* _chunk, const opcode_e _opcode, const uint8_t _operand, const uint _line)
+{
+	_chunk->data = ALLOCATE(uint8_t, 3, MEMORY_BYTECODE);
+	_chunk->lines = ALLOCATE(uint, 3, MEMORY_LINES);
+	_chunk->capacity = 3;
+	_chunk->size = 2;
+	_chunk->data[0] = _opcode;
+	_chunk->data[1] = _operand;
+	_chunk->lines[0] = _chunk->lines[1] = _line;
+	_chunk->verified = false;
+	_chunk->stack_depth = 0;
+	_chunk->frame_depth = 0;
+	_chunk->literals.data = NULL;
+	_chunk->literals.size = 0;
+	_chunk->literals.capacity = 0;
+	init_functions_array(&_chunk->functions);
+	init_names_array(&_chunk->inputs);
 }
 
 void free_chunk(chunk_s* _chunk)
 {
 	free_literals_array(&_chunk->literals);
-	free(_chunk->data);
-	free(_chunk->lines);
+	free_functions_array(&_chunk->functions);
+	free_names_array(&_chunk->inputs);
+	FREE_ARRAY(uint8_t, _chunk->data, _chunk->capacity, MEMORY_BYTECODE);
+	FREE_ARRAY(uint, _chunk->lines, _chunk->capacity, MEMORY_LINES);
 	_chunk->data = NULL; //is that needed?
 	_chunk->lines = NULL; //is that needed?
 }
@@ -40,16 +70,109 @@ void append_chunk(chunk_s* _chunk, const opcode_e _value_t, const uint _line_num
 	_chunk->lines[_chunk->size - 1] = _line_number;
 }
 
+size_t chunk_memory(const chunk_s* _chunk)
+{
+	size_t bytes = _chunk->capacity * (sizeof(uint8_t) + sizeof(uint));
+	bytes += _chunk->literals.capacity * sizeof(value_t);
+
+	bytes += _chunk->functions.capacity * sizeof(function_s*);
+	for(uint i = 0; i < _chunk->functions.size; ++i) {
+		const function_s* function = _chunk->functions.data[i];
+		bytes += sizeof(function_s) + strlen(function->name) + 1 + chunk_memory(&function->chunk);
+		if(function->lazy) bytes += sizeof(lazy_body_s) + function->lazy->length + 1;
+	}
+
+	bytes += _chunk->inputs.capacity * sizeof(char*);
+	for(uint i = 0; i < _chunk->inputs.size; ++i) {
+		bytes += strlen(_chunk->inputs.data[i]) + 1;
+	}
+	return bytes;
+}
+
 int append_literal(chunk_s* _chunk, const value_t _value_t)
 {
 	return append_literals_array(&_chunk->literals, _value_t);
 }
 
+function_s* new_function(const char* _name, const uint _length)
+{
+	function_s* function = ALLOCATE(function_s, 1, MEMORY_FUNCTIONS);
+	init_chunk(&function->chunk);
+	function->arity = 0;
+	function->defined = false;
+	function->lazy = NULL;
+	// names point into the source otherwise, which may be gone by the time it runs
+	function->name = ALLOCATE(char, _length + 1, MEMORY_FUNCTIONS);
+	memcpy(function->name, _name, _length);
+	function->name[_length] = '\0';
+	return function;
+}
+
+void free_function(function_s* _function)
+{
+	lazy_body_s* lazy = _function->lazy;
+	if(lazy) {
+		if(lazy->body) {
+			free_chunk(lazy->body);
+			FREE(chunk_s, lazy->body, MEMORY_FUNCTIONS);
+		}
+		FREE_ARRAY(char, lazy->source, lazy->length + 1, MEMORY_FUNCTIONS);
+		FREE(lazy_body_s, lazy, MEMORY_FUNCTIONS);
+	}
+	free_chunk(&_function->chunk);
+	FREE_ARRAY(char, _function->name, strlen(_function->name) + 1, MEMORY_FUNCTIONS);
+	FREE(function_s, _function, MEMORY_FUNCTIONS);
+}
+
+chunk_s* function_body(function_s* _function)
+{
+	if(!_function->lazy) return &_function->chunk;
+	return __atomic_load_n(&_function->lazy->body, __ATOMIC_ACQUIRE);
+}
+
+int append_function(chunk_s* _chunk, function_s* _function)
+{
+	functions_array_s* array = &_chunk->functions;
+	if(array->capacity <= array->size) {
+		const uint capacity = array->capacity == 0 ? 8 : array->capacity * 2;
+		array->data = GROW_ARRAY(function_s*, array->data, array->capacity, capacity, MEMORY_FUNCTIONS);
+		array->capacity = capacity;
+	}
+	array->data[array->size++] = _function;
+	return array->size - 1;
+}
+
+int append_input(chunk_s* _chunk, const char* _name, const uint _length)
+{
+	names_array_s* array = &_chunk->inputs;
+	if(array->capacity <= array->size) {
+		const uint capacity = array->capacity == 0 ? 8 : array->capacity * 2;
+		array->data = GROW_ARRAY(char*, array->data, array->capacity, capacity, MEMORY_INPUTS);
+		array->capacity = capacity;
+	}
+	char* name = ALLOCATE(char, _length + 1, MEMORY_INPUTS);
+	memcpy(name, _name, _length);
+	name[_length] = '\0';
+	array->data[array->size++] = name;
+	return array->size - 1;
+}
+
+int find_input(const chunk_s* _chunk, const char* _name, const uint _length)
+{
+	const names_array_s* array = &_chunk->inputs;
+	for(uint i = 0; i < array->size; ++i) {
+		if(strlen(array->data[i]) == _length && memcmp(array->data[i], _name, _length) == 0) {
+			return (int)i;
+		}
+	}
+	return -1;
+}
+
 ////////////////////////////////////////// static implementations
 static void realloc_chunk(chunk_s** _chunk)
 {
-	(*_chunk)->data  = realloc((*_chunk)->data, (*_chunk)->capacity * 2);
-	(*_chunk)->lines = realloc((*_chunk)->lines, (*_chunk)->capacity * 2);
+	(*_chunk)->data  = GROW_ARRAY(uint8_t, (*_chunk)->data, (*_chunk)->capacity, (*_chunk)->capacity * 2, MEMORY_BYTECODE);
+	(*_chunk)->lines = GROW_ARRAY(uint, (*_chunk)->lines, (*_chunk)->capacity, (*_chunk)->capacity * 2, MEMORY_LINES);
 	(*_chunk)->capacity *= 2;
 	//TODO: find a way to init memory smartly here
 }
@@ -57,7 +180,7 @@ static void realloc_chunk(chunk_s** _chunk)
 /////////////////// helpers
 static void realloc_literals_array(literals_array_s** _array)
 {
-	(*_array)->data = realloc((*_array)->data, (*_array)->capacity * 2);
+	(*_array)->data = GROW_ARRAY(value_t, (*_array)->data, (*_array)->capacity, (*_array)->capacity * 2, MEMORY_LITERALS);
 	//no need to check. i mean what am i gonna to do if this fails anyways...
 	(*_array)->capacity *= 2;
 	//TODO: find a way to init memory smartly here
@@ -66,15 +189,14 @@ static void realloc_literals_array(literals_array_s** _array)
 static void init_literals_array(literals_array_s* _array)
 {
 	//TODO: check if aligned_alloc(); can be better here
-	_array->data = (value_t*)malloc(sizeof(value_t) * chunk_init_size);
-	memset(_array->data, '\0', chunk_init_size);
+	_array->data = (value_t*)allocate_zeroed(sizeof(value_t) * chunk_init_size, MEMORY_LITERALS);
 	_array->capacity = chunk_init_size;
 	_array->size = 0;
 }
 
 static void free_literals_array(literals_array_s* _array)
 {
-	free(_array->data);
+	FREE_ARRAY(value_t, _array->data, _array->capacity, MEMORY_LITERALS);
 }
 
 static int append_literals_array(literals_array_s* _array, const value_t _value_t)
@@ -85,3 +207,40 @@ static int append_literals_array(literals_array_s* _array, const value_t _value_
 	_array->data[_array->size - 1] = _value_t;
 	return _array->size - 1;
 }
+
+// most chunks never own a function, so nothing is allocated up front
+static void init_functions_array(functions_array_s* _array)
+{
+	_array->data = NULL;
+	_array->capacity = 0;
+	_array->size = 0;
+}
+
+static void free_functions_array(functions_array_s* _array)
+{
+	for(uint i = 0; i < _array->size; ++i) {
+		free_function(_array->data[i]);
+	}
+	FREE_ARRAY(function_s*, _array->data, _array->capacity, MEMORY_FUNCTIONS);
+	_array->data = NULL;
+	_array->size = 0;
+	_array->capacity = 0;
+}
+
+static void init_names_array(names_array_s* _array)
+{
+	_array->data = NULL;
+	_array->capacity = 0;
+	_array->size = 0;
+}
+
+static void free_names_array(names_array_s* _array)
+{
+	for(uint i = 0; i < _array->size; ++i) {
+		FREE_ARRAY(char, _array->data[i], strlen(_array->data[i]) + 1, MEMORY_INPUTS);
+	}
+	FREE_ARRAY(char*, _array->data, _array->capacity, MEMORY_INPUTS);
+	_array->data = NULL;
+	_array->size = 0;
+	_array->capacity = 0;
+}
@@ -1,15 +1,28 @@
 #include "../include/compiler.h"
 #include "../include/scanner.h"
+#include "../include/ir.h"
+#include "../include/native.h"
+#include "../include/verifier.h"
+#include "../include/memory.h"
+
+#include <errno.h>
+#include <pthread.h>
 
 #ifdef DEBUG_PRINT_CODE
 #include "../include/debug.h"
 #endif
 
-typedef void(*parse_fn_t)();
+#define LOCALS_MAX (UINT8_MAX + 1)
+
+typedef void(*parse_fn_t)(bool);
 
+// tokens are indices into the stream the whole source was scanned into
 typedef struct {
-	token_s current;
-	token_s previous;
+	uint current;
+	uint previous;
+	uint line;		// of previous, it tags everything emitted
+	uint line_run;	// cursor for stream_line()
+	token_type_e type;	// of current, checked far more often than it changes
 	bool had_error;
 	bool panic_mode;
 }parser_s;
@@ -24,7 +37,7 @@ typedef enum {
   PREC_TERM,        // + -
   PREC_FACTOR,      // * /
   PREC_UNARY,       // ! -
-  PREC_CALL,        // . ()
+  PREC_CALL,        // . () []
   PREC_PRIMARY
 }precedence_e;
 
@@ -34,18 +47,61 @@ typedef struct {
 	precedence_e precedence;
 }parse_rule_s;
 
+// names are kept as text, the token that declared a local may have left
+// the token window long before the local is used
+typedef struct {
+	const char* name;
+	uint length;
+	int depth;	// -1 while its initializer is being compiled
+}local_s;
+
+typedef struct compiler_s {
+	struct compiler_s* enclosing;
+	function_s* function;	// NULL while compiling the top level script
+	chunk_s* chunk;
+	local_s locals[LOCALS_MAX];
+	int local_count;
+	int scope_depth;
+	bool has_result;		// trailing expression left on the stack for OP_RETURN
+	int last_comparison;	// offset of the last emitted comparison, -1 if none
+	int last_call;			// offset of the last emitted call, -1 if none
+	int last_label;			// last offset some jump was patched to land on
+}compiler_s;
+
 
 static void expression();
-static void number();
-static void grouping();
-static void unary();
-static void binary();
+static void declaration();
+static void statement();
+static void var_declaration();
+static void fun_declaration();
+static uint8_t parameter_list();
+static void skim_body(function_s*, const uint8_t, const char*, const uint);
+static void declare_callee(const uint);
+static uint8_t count_arguments(const uint);
+static void return_statement();
+static void print_statement();
+static void if_statement();
+static void while_statement();
+static void block();
+static void expression_statement();
+static void number(bool);
+static void grouping(bool);
+static void array_literal(bool);
+static void index_(bool);
+static void unary(bool);
+static void binary(bool);
+static void literal(bool);
+static void variable(bool);
+static void and_(bool);
+static void or_(bool);
 
 static const parse_rule_s rules[] = {
   [TOKEN_LEFT_PAREN]    = {grouping, NULL,   PREC_NONE},
   [TOKEN_RIGHT_PAREN]   = {NULL,     NULL,   PREC_NONE},
   [TOKEN_LEFT_BRACE]    = {NULL,     NULL,   PREC_NONE},
   [TOKEN_RIGHT_BRACE]   = {NULL,     NULL,   PREC_NONE},
+  [TOKEN_LEFT_BRACKET]  = {array_literal, index_, PREC_CALL},
+  [TOKEN_RIGHT_BRACKET] = {NULL,     NULL,   PREC_NONE},
   [TOKEN_COMMA]         = {NULL,     NULL,   PREC_NONE},
   [TOKEN_DOT]           = {NULL,     NULL,   PREC_NONE},
   [TOKEN_MINUS]         = {unary,    binary, PREC_TERM},
@@ -53,31 +109,31 @@ static const parse_rule_s rules[] = {
   [TOKEN_SEMICOLON]     = {NULL,     NULL,   PREC_NONE},
   [TOKEN_SLASH]         = {NULL,     binary, PREC_FACTOR},
   [TOKEN_STAR]          = {NULL,     binary, PREC_FACTOR},
-  [TOKEN_BANG]          = {NULL,     NULL,   PREC_NONE},
-  [TOKEN_BANG_EQUAL]    = {NULL,     NULL,   PREC_NONE},
+  [TOKEN_BANG]          = {unary,    NULL,   PREC_NONE},
+  [TOKEN_BANG_EQUAL]    = {NULL,     binary, PREC_EQUALITY},
   [TOKEN_EQUAL]         = {NULL,     NULL,   PREC_NONE},
-  [TOKEN_EQUAL_EQUAL]   = {NULL,     NULL,   PREC_NONE},
-  [TOKEN_GREATER]       = {NULL,     NULL,   PREC_NONE},
-  [TOKEN_GREATER_EQUAL] = {NULL,     NULL,   PREC_NONE},
-  [TOKEN_LESS]          = {NULL,     NULL,   PREC_NONE},
-  [TOKEN_LESS_EQUAL]    = {NULL,     NULL,   PREC_NONE},
-  [TOKEN_IDENTIFIER]    = {NULL,     NULL,   PREC_NONE},
+  [TOKEN_EQUAL_EQUAL]   = {NULL,     binary, PREC_EQUALITY},
+  [TOKEN_GREATER]       = {NULL,     binary, PREC_COMPARISON},
+  [TOKEN_GREATER_EQUAL] = {NULL,     binary, PREC_COMPARISON},
+  [TOKEN_LESS]          = {NULL,     binary, PREC_COMPARISON},
+  [TOKEN_LESS_EQUAL]    = {NULL,     binary, PREC_COMPARISON},
+  [TOKEN_IDENTIFIER]    = {variable, NULL,   PREC_NONE},
   [TOKEN_STRING]        = {NULL,     NULL,   PREC_NONE},
   [TOKEN_NUMBER]        = {number,   NULL,   PREC_NONE},
-  [TOKEN_AND]           = {NULL,     NULL,   PREC_NONE},
+  [TOKEN_AND]           = {NULL,     and_,   PREC_AND},
   [TOKEN_CLASS]         = {NULL,     NULL,   PREC_NONE},
   [TOKEN_ELSE]          = {NULL,     NULL,   PREC_NONE},
-  [TOKEN_FALSE]         = {NULL,     NULL,   PREC_NONE},
+  [TOKEN_FALSE]         = {literal,  NULL,   PREC_NONE},
   [TOKEN_FOR]           = {NULL,     NULL,   PREC_NONE},
   [TOKEN_FUN]           = {NULL,     NULL,   PREC_NONE},
   [TOKEN_IF]            = {NULL,     NULL,   PREC_NONE},
-  [TOKEN_NIL]           = {NULL,     NULL,   PREC_NONE},
-  [TOKEN_OR]            = {NULL,     NULL,   PREC_NONE},
+  [TOKEN_NIL]           = {literal,  NULL,   PREC_NONE},
+  [TOKEN_OR]            = {NULL,     or_,    PREC_OR},
   [TOKEN_PRINT]         = {NULL,     NULL,   PREC_NONE},
   [TOKEN_RETURN]        = {NULL,     NULL,   PREC_NONE},
   [TOKEN_SUPER]         = {NULL,     NULL,   PREC_NONE},
   [TOKEN_THIS]          = {NULL,     NULL,   PREC_NONE},
-  [TOKEN_TRUE]          = {NULL,     NULL,   PREC_NONE},
+  [TOKEN_TRUE]          = {literal,  NULL,   PREC_NONE},
   [TOKEN_VAR]           = {NULL,     NULL,   PREC_NONE},
   [TOKEN_WHILE]         = {NULL,     NULL,   PREC_NONE},
   [TOKEN_ERROR]         = {NULL,     NULL,   PREC_NONE},
@@ -85,46 +141,227 @@ static const parse_rule_s rules[] = {
 };
 
 static parser_s parser; //TODO: can this be static?
-static chunk_s* compiling_chunk;
+static token_stream_s tokens;
+static compiler_options_s options;
+static ir_s ir;
+static compiler_s* current;
+static chunk_s* root_chunk;	// owns every function of the program
+static bool inputs_allowed;
+static bool deferred;		// compiling a lazy body, nothing may be added to root_chunk
+static lazy_stats_s stats;
+// all of the above is shared, compile_function() may run on any thread
+static pthread_mutex_t compiler_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static void init_module(chunk_s*);
+static void init_compiler(compiler_s*, chunk_s*, function_s*);
 static void advance();
+static void skip_errors();
 static void error_at_current(const char*);
 static void error(const char*);
-static void error_at(token_s*, const char*);
+static void error_at(const uint, const char*);
 static void consume(const token_type_e, const char*);
+static bool check(const token_type_e);
+static bool match(const token_type_e);
+static void synchronize();
 static void emit_byte(const uint8_t);
 static void emit_bytes(const uint8_t, const uint8_t);
+static bool emit_pure(const opcode_e);
+static void flush_ir();
+static uint emit_jump(const opcode_e);
+static uint emit_jump_if_false();
+static void emit_loop(const uint);
+static void patch_jump(const uint);
 static chunk_s* current_chunk();
 static void end_compiler();
 static void emit_return();
-static void emit_constant(const double);
+static void emit_constant(const value_t);
 static void parse_precedence(const precedence_e);
+static void begin_scope();
+static void end_scope();
+static void declare_variable();
+static void add_local(const uint);
+static int resolve_local(const uint);
+static bool identifiers_equal(const uint, const local_s*);
+static int resolve_function(const uint);
+static int resolve_input(const uint);
+static token_type_e type_of(const uint);
+static const char* start_of(const uint);
+static uint length_of(const uint);
+static void call(const int);
+static void native_call(const uint);
+static uint8_t argument_list();
 
-static uint8_t make_constant(const double);
+static uint8_t make_constant(const value_t);
+static opcode_e fused_jump(const opcode_e);
 
 static const parse_rule_s* get_rule(const token_type_e);
+static bool compile_source(const char*, chunk_s*, const bool);
+static bool compile_body(chunk_s*, function_s*, chunk_s*);
+static void start_tokens(const char*, const uint);
 
 bool compile(const char* _code, chunk_s* _chunk)
 {
+	return compile_source(_code, _chunk, false);
+}
+
+bool compile_with_inputs(const char* _code, chunk_s* _chunk)
+{
+	return compile_source(_code, _chunk, true);
+}
+
+chunk_s* compile_function(chunk_s* _script, function_s* _function)
+{
+	chunk_s* body = function_body(_function);
+	if(body) return body;
+
+	lazy_body_s* lazy = _function->lazy;
+	pthread_mutex_lock(&compiler_lock);
+	if(!lazy->body && !lazy->failed) {
+		body = ALLOCATE(chunk_s, 1, MEMORY_FUNCTIONS);
+		init_chunk(body);
+		bool compiled = compile_body(_script, _function, body);
+		if(compiled) {
+			verify_report_s report = verify_chunk(body, _script, _function->arity);
+			if(report.result != VERIFY_OK) {
+				fprintf(stderr, "[line %d] Verification error at %04d: %s\n",
+						verify_report_line(&report), report.offset, verify_result_message(report.result));
+				compiled = false;
+			}
+		}
+
+		if(compiled) {
+			// callers that see the pointer see the whole chunk
+			__atomic_store_n(&lazy->body, body, __ATOMIC_RELEASE);
+			++stats.compiled;
+		} else {
+			free_chunk(body);
+			FREE(chunk_s, body, MEMORY_FUNCTIONS);
+			lazy->failed = true;
+			++stats.failed;
+		}
+	}
+	body = lazy->body;
+	pthread_mutex_unlock(&compiler_lock);
+	return body;
+}
+
+lazy_stats_s lazy_stats()
+{
+	pthread_mutex_lock(&compiler_lock);
+	lazy_stats_s copy = stats;
+	pthread_mutex_unlock(&compiler_lock);
+	return copy;
+}
+
+void print_lazy_stats(FILE* _file)
+{
+	lazy_stats_s copy = lazy_stats();
+	fprintf(_file, "lazy functions: %" PRIu64 " skimmed, %" PRIu64 " compiled on first call, %" PRIu64 " failed\n",
+			copy.skimmed, copy.compiled, copy.failed);
+}
+
+static bool compile_source(const char* _code, chunk_s* _chunk, const bool _inputs)
+{
+	pthread_mutex_lock(&compiler_lock);
+	compiler_s compiler;
+	inputs_allowed = _inputs;
+	deferred = false;
 	init_module(_chunk);
-	init_scanner(_code);
-	advance();
-	expression();
-	consume(TOKEN_EOF, "Expect end of expression\n");
+	init_compiler(&compiler, _chunk, NULL);
+	init_ir(&ir, options.dump_ir);
+	start_tokens(_code, 1);
+	while(!match(TOKEN_EOF)) {
+		declaration();
+	}
 	end_compiler();
+	free_token_stream(&tokens);
+
+	for(uint i = 0; i < _chunk->functions.size; ++i) {
+		if(!_chunk->functions.data[i]->defined) {
+			fprintf(stderr, "Error: function '%s' is called but never declared\n", _chunk->functions.data[i]->name);
+			parser.had_error = true;
+		}
+	}
 	// return false on error.
+	const bool compiled = !parser.had_error;
+	pthread_mutex_unlock(&compiler_lock);
+	return compiled;
+}
+
+// with the options and the script of when it was skimmed, the compiler
+// state is set up as if fun_declaration() had just got to the body
+static bool compile_body(chunk_s* _script, function_s* _function, chunk_s* _body)
+{
+	const lazy_body_s* lazy = _function->lazy;
+	const compiler_options_s saved = options;
+	options.optimization_level = lazy->optimization_level;
+	inputs_allowed = false;
+	deferred = true;
+	init_module(_script);
+	init_ir(&ir, options.dump_ir);
+	start_tokens(lazy->source, lazy->line);
+
+	compiler_s compiler;
+	init_compiler(&compiler, _body, _function);
+	begin_scope();
+	consume(TOKEN_LEFT_PAREN, "Expect '(' after function name");
+	if(parameter_list() != _function->arity) error("parameters changed since the function was skimmed");
+	consume(TOKEN_LEFT_BRACE, "Expect '{' before function body");
+	block();
+	end_compiler();
+	free_token_stream(&tokens);
+
+	deferred = false;
+	options = saved;
 	return !parser.had_error;
 }
 
+// a lazy body is scanned on its own, starting on the line it was on
+static void start_tokens(const char* _code, const uint _line)
+{
+	if(options.token_stream) {
+		scan_tokens(&tokens, _code, _line);
+	} else {
+		open_token_window(&tokens, _code, _line);
+	}
+	parser.current	= 0;
+	parser.previous = 0;
+	parser.line_run = 0;
+	parser.line		= stream_line(&tokens, &parser.line_run, 0);
+	skip_errors();
+}
+
+void set_compiler_options(const compiler_options_s _options)
+{
+	options = _options;
+}
+
+compiler_options_s get_compiler_options()
+{
+	return options;
+}
 
 static void advance()
 {
 	parser.previous = parser.current;
-	while(1) {
-		parser.current = scan_token();
-		if(parser.current.type != TOKEN_ERROR) break;
-		error_at_current(parser.current.start);
+	// most tokens are on the line of the one before
+	const uint next_run = parser.line_run + 1;
+	if(tokens.lines) {
+		parser.line = tokens.lines[parser.previous & tokens.mask];
+	} else if(next_run < tokens.run_count && tokens.run_starts[next_run] <= parser.previous) {
+		parser.line = stream_line(&tokens, &parser.line_run, parser.previous);
+	}
+	if(parser.type != TOKEN_EOF) ++parser.current;
+	parser.type = type_of(parser.current);
+	if(parser.type == TOKEN_ERROR) skip_errors();
+}
+
+// the stream always ends with TOKEN_EOF, so this stops
+static void skip_errors()
+{
+	while((parser.type = type_of(parser.current)) == TOKEN_ERROR) {
+		error_at_current(stream_token(&tokens, parser.current).start);
+		++parser.current;
 	}
 }
 
@@ -132,31 +369,47 @@ static void init_module(chunk_s* _chunk)
 {
 	parser.had_error  = false;
 	parser.panic_mode = false;
-	compiling_chunk	  = _chunk;
+	root_chunk		  = _chunk;
+	current			  = NULL;
+}
+
+static void init_compiler(compiler_s* _compiler, chunk_s* _chunk, function_s* _function)
+{
+	_compiler->enclosing	   = current;
+	_compiler->function		   = _function;
+	_compiler->chunk		   = _chunk;
+	_compiler->local_count	   = 0;
+	_compiler->scope_depth	   = 0;
+	_compiler->has_result	   = false;
+	_compiler->last_comparison = -1;
+	_compiler->last_call	   = -1;
+	_compiler->last_label	   = -1;
+	current = _compiler;
 }
 
 static void error_at_current(const char* _message)
 {
-	error_at(&parser.current, _message);
+	error_at(parser.current, _message);
 }
 
 static void error(const char* _message)
 {
-	error_at(&parser.previous, _message);
+	error_at(parser.previous, _message);
 }
 
-static void error_at(token_s* _token, const char* _message)
+static void error_at(const uint _index, const char* _message)
 {
 	if(parser.panic_mode) return;
 	parser.panic_mode = true;
 
-	fprintf(stderr, "[line %d] Error", _token->line);
-	if(_token->type == TOKEN_EOF) {
+	token_s token = stream_token(&tokens, _index);
+	fprintf(stderr, "[line %d] Error", token.line);
+	if(token.type == TOKEN_EOF) {
 		fprintf(stderr, "at the end");
-	} else if(_token->type == TOKEN_ERROR) {
+	} else if(token.type == TOKEN_ERROR) {
 		//nuthin...
 	} else {
-		fprintf(stderr, "at %.*s", _token->length, _token->start);
+		fprintf(stderr, "at %.*s", token.length, token.start);
 	}
 
 	fprintf(stderr, ": %s\n", _message);
@@ -165,16 +418,51 @@ static void error_at(token_s* _token, const char* _message)
 
 static void consume(const token_type_e _token_type, const char* _message)
 {
-	if(parser.current.type == _token_type) {
+	if(parser.type == _token_type) {
 		advance();
 		return;
 	}
 	error_at_current(_message);
 }
 
+static bool check(const token_type_e _token_type)
+{
+	return parser.type == _token_type;
+}
+
+static bool match(const token_type_e _token_type)
+{
+	if(!check(_token_type)) return false;
+	advance();
+	return true;
+}
+
+static void synchronize()
+{
+	parser.panic_mode = false;
+
+	while(type_of(parser.current) != TOKEN_EOF) {
+		if(type_of(parser.previous) == TOKEN_SEMICOLON) return;
+		switch(type_of(parser.current)) {
+			case TOKEN_CLASS:
+			case TOKEN_FUN:
+			case TOKEN_VAR:
+			case TOKEN_FOR:
+			case TOKEN_IF:
+			case TOKEN_WHILE:
+			case TOKEN_PRINT:
+			case TOKEN_RETURN:
+				return;
+			default: break;
+		}
+		advance();
+	}
+}
+
 static void emit_byte(const uint8_t _byte)
 {
-	append_chunk(current_chunk(), _byte, parser.previous.line);
+	flush_ir();
+	append_chunk(current_chunk(), _byte, parser.line);
 }
 
 static inline void emit_bytes(const uint8_t _byte, const uint8_t _byte2)
@@ -183,19 +471,107 @@ static inline void emit_bytes(const uint8_t _byte, const uint8_t _byte2)
 	emit_byte(_byte2);
 }
 
+// side effect free instructions go to the IR when optimizing. The IR turns
+// them down when its operands were lowered already or it ran out of room,
+// then they are emitted as is. Returns true if the instruction was emitted.
+static bool emit_pure(const opcode_e _op)
+{
+	if(options.optimization_level > 0) {
+		bool taken = false;
+		switch(_op) {
+			case OP_NIL:
+			case OP_TRUE:
+			case OP_FALSE:	  taken = ir_literal(&ir, _op, parser.line); break;
+			case OP_NEGATION:
+			case OP_NOT:	  taken = ir_unary(&ir, _op, parser.line); break;
+			default:		  taken = ir_binary(&ir, _op, parser.line); break;
+		}
+		if(taken) return false;
+	}
+	emit_byte(_op);
+	return true;
+}
+
+// everything that looks at or patches the chunk needs the IR lowered first
+static void flush_ir()
+{
+	int last_comparison = ir_lower(&ir, current_chunk());
+	if(ir.error) {
+		error("too many constants in one chunk");
+		ir.error = false;
+	}
+	if(last_comparison != -1) current->last_comparison = last_comparison;
+}
+
+// returns offset of the operand, so it can be patched once the target is known
+static uint emit_jump(const opcode_e _jump)
+{
+	emit_byte(_jump);
+	emit_bytes(0xff, 0xff);
+	return current_chunk()->size - 2;
+}
+
+// jump taken when the condition just compiled is false. If the condition
+// ended in a comparison, the comparison is folded into the jump itself
+static uint emit_jump_if_false()
+{
+	flush_ir();
+	chunk_s* chunk = current_chunk();
+	int last = (int)chunk->size - 1;
+
+	// something already jumps past the comparison and expects a boolean there
+	if(current->last_comparison != last || current->last_label == (int)chunk->size) {
+		return emit_jump(OP_JUMP_IF_FALSE);
+	}
+
+	opcode_e comparison = chunk->data[last];
+	--chunk->size;
+	current->last_comparison = -1;
+	return emit_jump(fused_jump(comparison));
+}
+
+static void emit_loop(const uint _loop_start)
+{
+	emit_byte(OP_LOOP);
+
+	uint offset = current_chunk()->size - _loop_start + 2;
+	if(offset > UINT16_MAX) error("loop body too large");
+
+	emit_bytes((offset >> 8) & 0xff, offset & 0xff);
+}
+
+static void patch_jump(const uint _offset)
+{
+	flush_ir();
+	chunk_s* chunk = current_chunk();
+	// -2 to adjust for the jump offset itself
+	uint jump = chunk->size - _offset - 2;
+	if(jump > UINT16_MAX) {
+		error("too much code to jump over");
+	}
+
+	chunk->data[_offset]	 = (jump >> 8) & 0xff;
+	chunk->data[_offset + 1] = jump & 0xff;
+	current->last_label = chunk->size;
+}
+
 static chunk_s* current_chunk()
 {
-	return compiling_chunk;
+	return current->chunk;
 }
 
 static void end_compiler()
 {
+	if(!current->has_result) {
+		emit_byte(OP_NIL);
+	}
+	emit_return();
 #ifdef DEBUG_PRINT_CODE
 	if(!parser.had_error) {
-		disassemble_chunk(current_chunk, "code");
+		disassemble_chunk(current_chunk(), current->function ? current->function->name : "code");
 	}
 #endif
-	emit_return();
+	current = current->enclosing;
 }
 
 static void emit_return()
@@ -203,82 +579,666 @@ static void emit_return()
 	emit_byte(OP_RETURN);
 }
 
-static void emit_constant(const double _val)
+static void emit_constant(const value_t _val)
 {
+	if(options.optimization_level > 0 && ir_constant(&ir, _val, parser.line)) return;
 	emit_bytes(OP_CONSTANT, make_constant(_val));
 }
 
-static uint8_t make_constant(const double _val)
+static uint8_t make_constant(const value_t _val)
 {
-	uint8_t index = append_literal(current_chunk(), _val);
+	int index = append_literal(current_chunk(), _val);
 
 	if(index > UINT8_MAX) {
-		perror("too many constants\n");
+		error("too many constants in one chunk");
 		return 0;
 	}
 	return index;
 }
 
+static opcode_e fused_jump(const opcode_e _comparison)
+{
+	switch(_comparison) {
+		case OP_EQUAL:		   return OP_JUMP_IF_NOT_EQUAL;
+		case OP_NOT_EQUAL:	   return OP_JUMP_IF_EQUAL;
+		case OP_LESS:		   return OP_JUMP_IF_NOT_LESS;
+		case OP_LESS_EQUAL:	   return OP_JUMP_IF_NOT_LESS_EQUAL;
+		case OP_GREATER:	   return OP_JUMP_IF_NOT_GREATER;
+		case OP_GREATER_EQUAL: return OP_JUMP_IF_NOT_GREATER_EQUAL;
+		default:			   return OP_JUMP_IF_FALSE;
+	}
+}
+
 static void expression()
 {
 	parse_precedence(PREC_ASSIGNMENT);
 }
 
-static void number()
+static void declaration()
+{
+	if(match(TOKEN_FUN)) {
+		fun_declaration();
+	} else if(match(TOKEN_VAR)) {
+		var_declaration();
+	} else {
+		statement();
+	}
+
+	// locals declared here have to sit in their slots before anything else runs
+	flush_ir();
+	if(parser.panic_mode) synchronize();
+}
+
+static void statement()
+{
+	if(match(TOKEN_PRINT)) {
+		print_statement();
+	} else if(match(TOKEN_RETURN)) {
+		return_statement();
+	} else if(match(TOKEN_IF)) {
+		if_statement();
+	} else if(match(TOKEN_WHILE)) {
+		while_statement();
+	} else if(match(TOKEN_LEFT_BRACE)) {
+		begin_scope();
+		block();
+		end_scope();
+	} else {
+		expression_statement();
+	}
+}
+
+static void var_declaration()
+{
+	consume(TOKEN_IDENTIFIER, "Expect variable name");
+	declare_variable();
+
+	if(match(TOKEN_EQUAL)) {
+		expression();
+	} else {
+		emit_byte(OP_NIL);
+	}
+	consume(TOKEN_SEMICOLON, "Expect ';' after variable declaration");
+
+	// the value just left on the stack is the variable's slot
+	current->locals[current->local_count - 1].depth = current->scope_depth;
+}
+
+// functions live in the top level chunk and are called by index, they
+// can't capture anything so they may only be declared at the top level
+static void fun_declaration()
+{
+	consume(TOKEN_IDENTIFIER, "Expect function name");
+	if(current->function != NULL || current->scope_depth > 0) {
+		error("functions can only be declared at the top level");
+		return;
+	}
+
+	const uint name = parser.previous;
+	const char* start = start_of(name);
+	const uint length = length_of(name);
+	if(find_native(start, length) != -1) {
+		error("Already a native function with this name");
+		return;
+	}
+	int index = resolve_function(name);
+	bool called_before = index != -1;
+	if(index == -1) {
+		index = append_function(root_chunk, new_function(start, length));
+	} else if(root_chunk->functions.data[index]->defined) {
+		error("Already a function with this name");
+		return;
+	}
+	function_s* function = root_chunk->functions.data[index];
+	uint8_t expected_arity = function->arity;
+	function->defined = true;
+
+	compiler_s compiler;
+	init_compiler(&compiler, &function->chunk, function);
+	begin_scope();
+
+	const char* open = start_of(parser.current);
+	consume(TOKEN_LEFT_PAREN, "Expect '(' after function name");
+	const uint line = parser.line;
+	function->arity = parameter_list();
+
+	if(called_before && expected_arity != function->arity) {
+		error("function was already called with a different number of arguments");
+	}
+
+	consume(TOKEN_LEFT_BRACE, "Expect '{' before function body");
+	if(options.lazy && !inputs_allowed) {
+		skim_body(function, (uint8_t)index, open, line);
+		current = current->enclosing;
+		return;
+	}
+	block();
+	end_compiler();
+}
+
+static uint8_t parameter_list()
+{
+	uint8_t arity = 0;
+	if(!check(TOKEN_RIGHT_PAREN)) {
+		do {
+			if(arity == UINT8_MAX) {
+				error_at_current("Can't have more than 255 parameters");
+			}
+			++arity;
+			consume(TOKEN_IDENTIFIER, "Expect parameter name");
+			declare_variable();
+			current->locals[current->local_count - 1].depth = current->scope_depth;
+		} while(match(TOKEN_COMMA));
+	}
+	consume(TOKEN_RIGHT_PAREN, "Expect ')' after parameters");
+	return arity;
+}
+
+// only the braces are matched. The body is kept as text from the '(' of
+// the parameters on and the function becomes OP_LAZY, see compile_function()
+static void skim_body(function_s* _function, const uint8_t _index, const char* _open, const uint _line)
+{
+	uint depth = 1;
+	while(depth > 0 && !check(TOKEN_EOF)) {
+		if(check(TOKEN_LEFT_BRACE)) {
+			++depth;
+		} else if(check(TOKEN_RIGHT_BRACE)) {
+			--depth;
+		} else if(check(TOKEN_IDENTIFIER) && type_of(parser.current + 1) == TOKEN_LEFT_PAREN) {
+			declare_callee(parser.current);
+		}
+		advance();
+	}
+	if(depth > 0) {
+		error_at_current("Expect '}' after block");
+		return;
+	}
+
+	const char* end = start_of(parser.previous) + length_of(parser.previous);
+	lazy_body_s* lazy = ALLOCATE(lazy_body_s, 1, MEMORY_FUNCTIONS);
+	lazy->length = (uint)(end - _open);
+	lazy->source = ALLOCATE(char, lazy->length + 1, MEMORY_FUNCTIONS);
+	memcpy(lazy->source, _open, lazy->length);
+	lazy->source[lazy->length] = '\0';
+	lazy->line = _line;
+	lazy->optimization_level = options.optimization_level;
+	lazy->body = NULL;
+	lazy->failed = false;
+
+	free_chunk(&_function->chunk);
+	init_stub_chunk(&_function->chunk, OP_LAZY, _index, _line);
+	_function->lazy = lazy;
+	++stats.skimmed;
+}
+
+// a call in a skimmed body enters its callee like call() would, so calling
+// a function declared nowhere is still an error of the script, and no
+// function has to be added once the body is compiled
+static void declare_callee(const uint _name)
+{
+	if(find_native(start_of(_name), length_of(_name)) != -1 || resolve_function(_name) != -1) return;
+
+	function_s* function = new_function(start_of(_name), length_of(_name));
+	function->arity = count_arguments(_name + 1);
+	append_function(root_chunk, function);
+}
+
+// commas outside of any nested parentheses or array literals, _open is the
+// '(' of the call
+static uint8_t count_arguments(const uint _open)
+{
+	if(type_of(_open + 1) == TOKEN_RIGHT_PAREN) return 0;
+
+	uint count = 1;
+	uint depth = 0;
+	for(uint i = _open + 1; type_of(i) != TOKEN_EOF; ++i) {
+		const token_type_e type = type_of(i);
+		if(type == TOKEN_LEFT_PAREN || type == TOKEN_LEFT_BRACKET) {
+			++depth;
+		} else if(type == TOKEN_RIGHT_PAREN || type == TOKEN_RIGHT_BRACKET) {
+			if(depth == 0) break;
+			--depth;
+		} else if(type == TOKEN_COMMA && depth == 0) {
+			++count;
+		}
+	}
+	return count > UINT8_MAX ? UINT8_MAX : (uint8_t)count;
+}
+
+static void return_statement()
+{
+	if(current->function == NULL) {
+		error("Can't return from top-level code");
+	}
+
+	if(match(TOKEN_SEMICOLON)) {
+		emit_byte(OP_NIL);
+		emit_return();
+		return;
+	}
+
+	expression();
+	consume(TOKEN_SEMICOLON, "Expect ';' after return value");
+
+	// a call whose result is returned as is doesn't need its own frame. A
+	// body starting with "return x;" is shorter than a call, last_call is -1
+	// and so is the offset one would be at
+	flush_ir();
+	chunk_s* chunk = current_chunk();
+	const int call = (int)chunk->size - 3;
+	if(call >= 0 && current->last_call == call && current->last_label != (int)chunk->size) {
+		chunk->data[call] = OP_TAIL_CALL;
+	}
+	emit_return();
+}
+
+static void print_statement()
+{
+	expression();
+	consume(TOKEN_SEMICOLON, "Expect ';' after value");
+	emit_byte(OP_PRINT);
+}
+
+static void if_statement()
+{
+	consume(TOKEN_LEFT_PAREN, "Expect '(' after 'if'");
+	expression();
+	consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition");
+
+	uint then_jump = emit_jump_if_false();
+	statement();
+
+	if(match(TOKEN_ELSE)) {
+		uint else_jump = emit_jump(OP_JUMP);
+		patch_jump(then_jump);
+		statement();
+		patch_jump(else_jump);
+	} else {
+		patch_jump(then_jump);
+	}
+}
+
+static void while_statement()
+{
+	flush_ir();
+	uint loop_start = current_chunk()->size;
+	current->last_label = loop_start;
+
+	consume(TOKEN_LEFT_PAREN, "Expect '(' after 'while'");
+	expression();
+	consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition");
+
+	uint exit_jump = emit_jump_if_false();
+	statement();
+	emit_loop(loop_start);
+
+	patch_jump(exit_jump);
+}
+
+static void block()
+{
+	while(!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
+		declaration();
+	}
+	consume(TOKEN_RIGHT_BRACE, "Expect '}' after block");
+}
+
+static void expression_statement()
+{
+	expression();
+
+	// a trailing expression without ';' is the value the script returns
+	if(check(TOKEN_EOF) && current->scope_depth == 0) {
+		current->has_result = true;
+		return;
+	}
+
+	consume(TOKEN_SEMICOLON, "Expect ';' after expression");
+	if(options.optimization_level > 0 && ir_drop(&ir)) return;
+	emit_byte(OP_POP);
+}
+
+static void begin_scope()
+{
+	++current->scope_depth;
+}
+
+static void end_scope()
+{
+	--current->scope_depth;
+
+	while(current->local_count > 0 &&
+		  current->locals[current->local_count - 1].depth > current->scope_depth) {
+		emit_byte(OP_POP);
+		--current->local_count;
+	}
+}
+
+static void declare_variable()
+{
+	const uint name = parser.previous;
+
+	for(int i = current->local_count - 1; i >= 0; --i) {
+		local_s* local = &current->locals[i];
+		if(local->depth != -1 && local->depth < current->scope_depth) break;
+
+		if(identifiers_equal(name, local)) {
+			error("Already a variable with this name in this scope");
+		}
+	}
+
+	add_local(name);
+}
+
+static void add_local(const uint _name)
+{
+	if(current->local_count == LOCALS_MAX) {
+		error("too many local variables");
+		return;
+	}
+
+	local_s* local = &current->locals[current->local_count++];
+	local->name	  = start_of(_name);
+	local->length = length_of(_name);
+	local->depth  = -1;
+}
+
+static int resolve_local(const uint _name)
+{
+	for(int i = current->local_count - 1; i >= 0; --i) {
+		local_s* local = &current->locals[i];
+		if(identifiers_equal(_name, local)) {
+			if(local->depth == -1) {
+				error("Can't read local variable in its own initializer");
+			}
+			return i;
+		}
+	}
+	return -1;
+}
+
+static bool identifiers_equal(const uint _name, const local_s* _local)
+{
+	if(length_of(_name) != _local->length) return false;
+	return memcmp(start_of(_name), _local->name, _local->length) == 0;
+}
+
+// a literal without a fraction is an int, unless it doesn't fit in one
+static void number(bool _can_assign)
+{
+	const char* start = start_of(parser.previous);
+	const uint length = length_of(parser.previous);
+	if(!memchr(start, '.', length)) {
+		char* end;
+		errno = 0;
+		long long value = strtoll(start, &end, 10);
+		if(errno == 0 && end == start + length) {
+			emit_constant(INT_VAL((int64_t)value));
+			return;
+		}
+	}
+
+	double value = strtod(start, NULL);
+	emit_constant(NUMBER_VAL(value));
+}
+
+static void literal(bool _can_assign)
+{
+	switch(type_of(parser.previous)) {
+		case TOKEN_NIL:	  emit_pure(OP_NIL);   break;
+		case TOKEN_TRUE:  emit_pure(OP_TRUE);  break;
+		case TOKEN_FALSE: emit_pure(OP_FALSE); break;
+		default: return;
+	}
+}
+
+static void variable(bool _can_assign)
+{
+	int slot = resolve_local(parser.previous);
+	if(slot == -1 && check(TOKEN_LEFT_PAREN)) {
+		if(find_native(start_of(parser.previous), length_of(parser.previous)) != -1) {
+			native_call(parser.previous);
+		} else {
+			call(resolve_function(parser.previous));
+		}
+		return;
+	}
+	if(slot == -1 && inputs_allowed) {
+		int index = resolve_input(parser.previous);
+		if(_can_assign && match(TOKEN_EQUAL)) {
+			error("Can't assign to an input");
+		} else if(index != -1 && (options.optimization_level == 0 || !ir_input(&ir, (uint8_t)index, parser.line))) {
+			emit_bytes(OP_GET_INPUT, (uint8_t)index);
+		}
+		return;
+	}
+	if(slot == -1) {
+		error("Undefined variable");
+		return;
+	}
+
+	if(_can_assign && match(TOKEN_EQUAL)) {
+		expression();
+		emit_bytes(OP_SET_LOCAL, (uint8_t)slot);
+	} else if(options.optimization_level == 0 || !ir_local(&ir, (uint8_t)slot, parser.line)) {
+		emit_bytes(OP_GET_LOCAL, (uint8_t)slot);
+	}
+}
+
+static int resolve_function(const uint _name)
+{
+	const uint length = length_of(_name);
+	for(uint i = 0; i < root_chunk->functions.size; ++i) {
+		const char* name = root_chunk->functions.data[i]->name;
+		if(strlen(name) == length && memcmp(name, start_of(_name), length) == 0) {
+			return (int)i;
+		}
+	}
+	return -1;
+}
+
+// the first use of an input declares it
+static int resolve_input(const uint _name)
+{
+	int index = find_input(root_chunk, start_of(_name), length_of(_name));
+	if(index == -1) index = append_input(root_chunk, start_of(_name), length_of(_name));
+	if(index > UINT8_MAX) {
+		error("too many inputs");
+		return -1;
+	}
+	return index;
+}
+
+// a call ahead of the declaration creates the function with the arity seen
+// here, fun_declaration() checks it against the real parameter list
+static void call(const int _index)
 {
-	double value = strtod(parser.previous.start, NULL);
-	emit_constant(value);
+	// the arguments may take the name out of the token window
+	const char* name = start_of(parser.previous);
+	const uint length = length_of(parser.previous);
+	advance();
+	uint8_t argument_count = argument_list();
+
+	int index = _index;
+	if(index == -1 && deferred) {
+		error("function is never declared");
+		return;
+	}
+	if(index == -1) {
+		function_s* function = new_function(name, length);
+		function->arity = argument_count;
+		index = append_function(root_chunk, function);
+	} else if(root_chunk->functions.data[index]->arity != argument_count) {
+		error("wrong number of arguments");
+	}
+
+	if(index > UINT8_MAX) {
+		error("too many functions");
+		return;
+	}
+
+	emit_byte(OP_CALL);
+	emit_bytes((uint8_t)index, argument_count);
+	current->last_call = current_chunk()->size - 3;
 }
 
-static void grouping()
+// arguments stay where they are on the stack, the native reads them there.
+// Natives of one name differ in arity, the argument count picks one.
+static void native_call(const uint _name)
+{
+	const char* name = start_of(_name);
+	const uint length = length_of(_name);
+	advance();
+	uint8_t argument_count = argument_list();
+
+	const int index = resolve_native(name, length, argument_count);
+	if(index == -1) {
+		error("wrong number of arguments");
+		return;
+	}
+
+	switch(natives[index].kind) {
+		case NATIVE_NUMBER_1: emit_bytes(OP_CALL_NATIVE_1, (uint8_t)index); break;
+		case NATIVE_NUMBER_2: emit_bytes(OP_CALL_NATIVE_2, (uint8_t)index); break;
+		default:
+			emit_byte(OP_CALL_NATIVE);
+			emit_bytes((uint8_t)index, argument_count);
+			break;
+	}
+}
+
+static uint8_t argument_list()
+{
+	uint8_t argument_count = 0;
+	if(!check(TOKEN_RIGHT_PAREN)) {
+		do {
+			expression();
+			if(argument_count == UINT8_MAX) {
+				error("Can't have more than 255 arguments");
+			}
+			++argument_count;
+		} while(match(TOKEN_COMMA));
+	}
+	consume(TOKEN_RIGHT_PAREN, "Expect ')' after arguments");
+	return argument_count;
+}
+
+static void grouping(bool _can_assign)
 {
 	expression();
 	consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression");
 }
 
-static void unary()
+// [a, b, c] or [x; n], an array of n times x
+static void array_literal(bool _can_assign)
+{
+	if(match(TOKEN_RIGHT_BRACKET)) {
+		emit_bytes(OP_ARRAY, 0);
+		return;
+	}
+
+	expression();
+	if(match(TOKEN_SEMICOLON)) {
+		expression();
+		consume(TOKEN_RIGHT_BRACKET, "Expect ']' after the length of the array");
+		emit_byte(OP_ARRAY_FILL);
+		return;
+	}
+
+	uint8_t count = 1;
+	while(match(TOKEN_COMMA)) {
+		expression();
+		if(count == UINT8_MAX) {
+			error("Can't have more than 255 elements in an array literal");
+		}
+		++count;
+	}
+	consume(TOKEN_RIGHT_BRACKET, "Expect ']' after the elements");
+	emit_bytes(OP_ARRAY, count);
+}
+
+static void index_(bool _can_assign)
+{
+	expression();
+	consume(TOKEN_RIGHT_BRACKET, "Expect ']' after the index");
+	emit_byte(OP_INDEX);
+}
+
+static void unary(bool _can_assign)
 {
-	token_type_e operator_type = parser.previous.type;
+	token_type_e operator_type = type_of(parser.previous);
 
 	parse_precedence(PREC_UNARY);
 
 	switch(operator_type) {
-		case TOKEN_MINUS: emit_byte(OP_NEGATION); break;
+		case TOKEN_MINUS: emit_pure(OP_NEGATION); break;
+		case TOKEN_BANG:  emit_pure(OP_NOT);	  break;
 		default: return;
 	}
 }
 
-static void binary()
+static void binary(bool _can_assign)
 {
-	token_type_e operator_type = parser.previous.type;
+	token_type_e operator_type = type_of(parser.previous);
 	const parse_rule_s* rule = get_rule(operator_type);
 	parse_precedence((precedence_e)(rule->precedence + 1));
 
+	bool emitted = false;
 	switch(operator_type) {
-		case TOKEN_PLUS:  emit_byte(OP_ADD);	  break;
-		case TOKEN_MINUS: emit_byte(OP_SUBTRACT); break;
-		case TOKEN_STAR:  emit_byte(OP_MULTIPLY); break;
-		case TOKEN_SLASH: emit_byte(OP_DIVIDE);   break;
+		case TOKEN_PLUS:  emitted = emit_pure(OP_ADD);	   break;
+		case TOKEN_MINUS: emitted = emit_pure(OP_SUBTRACT); break;
+		case TOKEN_STAR:  emitted = emit_pure(OP_MULTIPLY); break;
+		case TOKEN_SLASH: emitted = emit_pure(OP_DIVIDE);   break;
+		case TOKEN_EQUAL_EQUAL:	  emitted = emit_pure(OP_EQUAL);		 break;
+		case TOKEN_BANG_EQUAL:	  emitted = emit_pure(OP_NOT_EQUAL);	 break;
+		case TOKEN_LESS:		  emitted = emit_pure(OP_LESS);			 break;
+		case TOKEN_LESS_EQUAL:	  emitted = emit_pure(OP_LESS_EQUAL);	 break;
+		case TOKEN_GREATER:		  emitted = emit_pure(OP_GREATER);		 break;
+		case TOKEN_GREATER_EQUAL: emitted = emit_pure(OP_GREATER_EQUAL); break;
 		default: return;
 	}
+
+	// through the IR this is tracked when it gets lowered, see flush_ir()
+	if(emitted && (rule->precedence == PREC_EQUALITY || rule->precedence == PREC_COMPARISON)) {
+		current->last_comparison = current_chunk()->size - 1;
+	}
 	return;
 }
 
+static void and_(bool _can_assign)
+{
+	uint end_jump = emit_jump(OP_JUMP_IF_FALSE_OR_POP);
+	parse_precedence(PREC_AND);
+	patch_jump(end_jump);
+}
+
+static void or_(bool _can_assign)
+{
+	uint end_jump = emit_jump(OP_JUMP_IF_TRUE_OR_POP);
+	parse_precedence(PREC_OR);
+	patch_jump(end_jump);
+}
+
 static void parse_precedence(const precedence_e _precedence)
 {
 	advance();
-	parse_fn_t prefix_rule = get_rule(parser.previous.type)->prefix;
+	parse_fn_t prefix_rule = get_rule(type_of(parser.previous))->prefix;
 	if(prefix_rule == NULL) {
 		error("expexted expression");
 		return;
 	}
 
-	prefix_rule();
+	bool can_assign = _precedence <= PREC_ASSIGNMENT;
+	prefix_rule(can_assign);
 
-	while(_precedence <= get_rule(parser.current.type)->precedence) {
+	while(_precedence <= get_rule(parser.type)->precedence) {
 		advance();
-		parse_fn_t infix_rule = get_rule(parser.previous.type)->infix;
-		infix_rule();
+		parse_fn_t infix_rule = get_rule(type_of(parser.previous))->infix;
+		infix_rule(can_assign);
+	}
+
+	if(can_assign && match(TOKEN_EQUAL)) {
+		error("Invalid assignment target");
 	}
 }
 
@@ -286,3 +1246,22 @@ static const parse_rule_s* get_rule(const token_type_e _type)
 {
 	return &rules[_type];
 }
+
+// a token window is filled as far as the parser looks ahead. Only tokens
+// from the previous one on are kept, nothing else holds a token index for
+// longer than that.
+static inline token_type_e type_of(const uint _index)
+{
+	if(_index >= tokens.count) fill_token_window(&tokens, _index, parser.previous);
+	return (token_type_e)tokens.types[_index & tokens.mask];
+}
+
+static inline const char* start_of(const uint _index)
+{
+	return tokens.source + tokens.offsets[_index & tokens.mask];
+}
+
+static inline uint length_of(const uint _index)
+{
+	return tokens.lengths[_index & tokens.mask];
+}
@@ -1,4 +1,5 @@
 #include "../include/debug.h"
+#include "../include/native.h"
 
 
 //////////// static variables
@@ -14,7 +15,9 @@ static void print_one_operand(const char* _name,
 							   const value_t _operand)
 {
 	printf("%-10s", _name);
-	printf(" oper: %g\n", _operand);
+	printf(" oper: ");
+	print_value(_operand);
+	printf("\n");
 }
 
 static void print_two_operands(const char* _name,
@@ -22,7 +25,58 @@ static void print_two_operands(const char* _name,
 							   const value_t _operand_2)
 {
 	printf("%-10s", _name);
-	printf(" opers: %g, %g\n", _operand_1, _operand_2);
+	printf(" opers: ");
+	print_value(_operand_1);
+	printf(", ");
+	print_value(_operand_2);
+	printf("\n");
+}
+
+static void print_slot_operand(const char* _name,
+							   const uint8_t _slot)
+{
+	printf("%-10s", _name);
+	printf(" slot: %d\n", _slot);
+}
+
+static void print_count_operand(const char* _name,
+								const uint8_t _count)
+{
+	printf("%-10s", _name);
+	printf(" n: %d\n", _count);
+}
+
+static void print_jump(const char* _name,
+					   const int _sign,
+					   chunk_s* _chunk,
+					   const uint _offset)
+{
+	uint16_t jump = (uint16_t)((_chunk->data[_offset + 1] << 8) | _chunk->data[_offset + 2]);
+	printf("%-10s", _name);
+	printf(" %04d -> %04d\n", _offset, _offset + 3 + _sign * jump);
+}
+
+static void print_call(const char* _name,
+					   const uint8_t _function,
+					   const uint8_t _argument_count)
+{
+	printf("%-10s", _name);
+	printf(" function: %d, args: %d\n", _function, _argument_count);
+}
+
+static void print_function_operand(const char* _name,
+								   const uint8_t _function)
+{
+	printf("%-10s", _name);
+	printf(" function: %d\n", _function);
+}
+
+static void print_native_call(const char* _name,
+							  const uint8_t _native,
+							  const uint8_t _argument_count)
+{
+	printf("%-10s", _name);
+	printf(" native: %s, args: %d\n", native_name(_native), _argument_count);
 }
 
 uint disassemble_instruction(chunk_s* _chunk, const uint _offset)
@@ -79,6 +133,226 @@ uint disassemble_instruction(chunk_s* _chunk, const uint _offset)
 			print_zero_operands("negation");
 			break;
 		}
+		case OP_NIL: {
+			instruction_size = 1;
+			print_zero_operands("nil");
+			break;
+		}
+		case OP_TRUE: {
+			instruction_size = 1;
+			print_zero_operands("true");
+			break;
+		}
+		case OP_FALSE: {
+			instruction_size = 1;
+			print_zero_operands("false");
+			break;
+		}
+		case OP_ADD_NUM_NUM: {
+			instruction_size = 1;
+			print_zero_operands("add_num_num");
+			break;
+		}
+		case OP_SUBTRACT_NUM_NUM: {
+			instruction_size = 1;
+			print_zero_operands("subtract_num_num");
+			break;
+		}
+		case OP_MULTIPLY_NUM_NUM: {
+			instruction_size = 1;
+			print_zero_operands("multiply_num_num");
+			break;
+		}
+		case OP_DIVIDE_NUM_NUM: {
+			instruction_size = 1;
+			print_zero_operands("divide_num_num");
+			break;
+		}
+		case OP_ADD_INT_INT: {
+			instruction_size = 1;
+			print_zero_operands("add_int_int");
+			break;
+		}
+		case OP_SUBTRACT_INT_INT: {
+			instruction_size = 1;
+			print_zero_operands("subtract_int_int");
+			break;
+		}
+		case OP_MULTIPLY_INT_INT: {
+			instruction_size = 1;
+			print_zero_operands("multiply_int_int");
+			break;
+		}
+		case OP_NOT: {
+			instruction_size = 1;
+			print_zero_operands("not");
+			break;
+		}
+		case OP_EQUAL: {
+			instruction_size = 1;
+			print_zero_operands("equal");
+			break;
+		}
+		case OP_NOT_EQUAL: {
+			instruction_size = 1;
+			print_zero_operands("not_equal");
+			break;
+		}
+		case OP_LESS: {
+			instruction_size = 1;
+			print_zero_operands("less");
+			break;
+		}
+		case OP_LESS_EQUAL: {
+			instruction_size = 1;
+			print_zero_operands("less_equal");
+			break;
+		}
+		case OP_GREATER: {
+			instruction_size = 1;
+			print_zero_operands("greater");
+			break;
+		}
+		case OP_GREATER_EQUAL: {
+			instruction_size = 1;
+			print_zero_operands("greater_equal");
+			break;
+		}
+		case OP_POP: {
+			instruction_size = 1;
+			print_zero_operands("pop");
+			break;
+		}
+		case OP_PRINT: {
+			instruction_size = 1;
+			print_zero_operands("print");
+			break;
+		}
+		case OP_GET_LOCAL: {
+			instruction_size = 2;
+			print_slot_operand("get_local", _chunk->data[_offset + 1]);
+			break;
+		}
+		case OP_SET_LOCAL: {
+			instruction_size = 2;
+			print_slot_operand("set_local", _chunk->data[_offset + 1]);
+			break;
+		}
+		case OP_GET_INPUT: {
+			instruction_size = 2;
+			print_slot_operand("get_input", _chunk->data[_offset + 1]);
+			break;
+		}
+		case OP_JUMP: {
+			instruction_size = 3;
+			print_jump("jump", 1, _chunk, _offset);
+			break;
+		}
+		case OP_LOOP: {
+			instruction_size = 3;
+			print_jump("loop", -1, _chunk, _offset);
+			break;
+		}
+		case OP_JUMP_IF_FALSE: {
+			instruction_size = 3;
+			print_jump("jump_if_false", 1, _chunk, _offset);
+			break;
+		}
+		case OP_JUMP_IF_FALSE_OR_POP: {
+			instruction_size = 3;
+			print_jump("jump_if_false_or_pop", 1, _chunk, _offset);
+			break;
+		}
+		case OP_JUMP_IF_TRUE_OR_POP: {
+			instruction_size = 3;
+			print_jump("jump_if_true_or_pop", 1, _chunk, _offset);
+			break;
+		}
+		case OP_JUMP_IF_NOT_EQUAL: {
+			instruction_size = 3;
+			print_jump("jump_if_not_equal", 1, _chunk, _offset);
+			break;
+		}
+		case OP_JUMP_IF_EQUAL: {
+			instruction_size = 3;
+			print_jump("jump_if_equal", 1, _chunk, _offset);
+			break;
+		}
+		case OP_JUMP_IF_NOT_LESS: {
+			instruction_size = 3;
+			print_jump("jump_if_not_less", 1, _chunk, _offset);
+			break;
+		}
+		case OP_JUMP_IF_NOT_LESS_EQUAL: {
+			instruction_size = 3;
+			print_jump("jump_if_not_less_equal", 1, _chunk, _offset);
+			break;
+		}
+		case OP_JUMP_IF_NOT_GREATER: {
+			instruction_size = 3;
+			print_jump("jump_if_not_greater", 1, _chunk, _offset);
+			break;
+		}
+		case OP_JUMP_IF_NOT_GREATER_EQUAL: {
+			instruction_size = 3;
+			print_jump("jump_if_not_greater_equal", 1, _chunk, _offset);
+			break;
+		}
+		case OP_CALL: {
+			instruction_size = 3;
+			print_call("call", _chunk->data[_offset + 1], _chunk->data[_offset + 2]);
+			break;
+		}
+		case OP_TAIL_CALL: {
+			instruction_size = 3;
+			print_call("tail_call", _chunk->data[_offset + 1], _chunk->data[_offset + 2]);
+			break;
+		}
+		case OP_CALL_NATIVE: {
+			instruction_size = 3;
+			print_native_call("call_native", _chunk->data[_offset + 1], _chunk->data[_offset + 2]);
+			break;
+		}
+		case OP_CALL_NATIVE_1: {
+			instruction_size = 2;
+			print_native_call("call_native_1", _chunk->data[_offset + 1], 1);
+			break;
+		}
+		case OP_CALL_NATIVE_2: {
+			instruction_size = 2;
+			print_native_call("call_native_2", _chunk->data[_offset + 1], 2);
+			break;
+		}
+		case OP_PICK: {
+			instruction_size = 2;
+			print_count_operand("pick", _chunk->data[_offset + 1]);
+			break;
+		}
+		case OP_SLIDE: {
+			instruction_size = 2;
+			print_count_operand("slide", _chunk->data[_offset + 1]);
+			break;
+		}
+		case OP_LAZY: {
+			instruction_size = 2;
+			print_function_operand("lazy", _chunk->data[_offset + 1]);
+			break;
+		}
+		case OP_ARRAY: {
+			instruction_size = 2;
+			print_count_operand("array", _chunk->data[_offset + 1]);
+			break;
+		}
+		case OP_ARRAY_FILL: {
+			instruction_size = 1;
+			print_zero_operands("array_fill");
+			break;
+		}
+		case OP_INDEX: {
+			instruction_size = 1;
+			print_zero_operands("index");
+			break;
+		}
 	}
 
 	// this will vary when we introduce operands
@@ -0,0 +1,156 @@
+#include "../include/fiber.h"
+
+#include "../include/memory.h"
+
+//////////// static functions
+static void* worker(void*);
+static void enqueue(scheduler_s*, fiber_s*);
+static fiber_s* dequeue(scheduler_s*);
+static interpret_result_e run_slice(fiber_s*);
+
+//////////// implementations
+scheduler_s* new_scheduler(const uint _threads, const uint64_t _slice)
+{
+	scheduler_s* scheduler = (scheduler_s*)allocate_zeroed(sizeof(scheduler_s), MEMORY_HANDLES);
+	pthread_mutex_init(&scheduler->lock, NULL);
+	pthread_cond_init(&scheduler->ready, NULL);
+	pthread_cond_init(&scheduler->finished, NULL);
+	scheduler->slice = _slice;
+
+	scheduler->thread_count = _threads == 0 ? 1 : _threads;
+	scheduler->threads = ALLOCATE(pthread_t, scheduler->thread_count, MEMORY_HANDLES);
+	for(uint i = 0; i < scheduler->thread_count; ++i) {
+		pthread_create(&scheduler->threads[i], NULL, worker, scheduler);
+	}
+	return scheduler;
+}
+
+void free_scheduler(scheduler_s* _scheduler)
+{
+	pthread_mutex_lock(&_scheduler->lock);
+	_scheduler->stopping = true;
+	pthread_cond_broadcast(&_scheduler->ready);
+	pthread_mutex_unlock(&_scheduler->lock);
+
+	for(uint i = 0; i < _scheduler->thread_count; ++i) {
+		pthread_join(_scheduler->threads[i], NULL);
+	}
+
+	pthread_mutex_destroy(&_scheduler->lock);
+	pthread_cond_destroy(&_scheduler->ready);
+	pthread_cond_destroy(&_scheduler->finished);
+	FREE_ARRAY(pthread_t, _scheduler->threads, _scheduler->thread_count, MEMORY_HANDLES);
+	FREE(scheduler_s, _scheduler, MEMORY_HANDLES);
+}
+
+fiber_s* spawn_fiber(scheduler_s* _scheduler, prepared_s* _prepared, const uint _priority, const uint64_t _quota)
+{
+	fiber_s* fiber = ALLOCATE(fiber_s, 1, MEMORY_HANDLES);
+	fiber->prepared = _prepared;
+	fiber->priority = _priority < FIBER_PRIORITIES ? _priority : FIBER_PRIORITIES - 1;
+	fiber->quota	= _quota;
+	fiber->slices	= 0;
+	fiber->started	= false;
+	fiber->status	= INTERPRETER_UNDEFINED;
+	fiber->result	= NIL_VAL;
+	fiber->next		= NULL;
+	vm_set_slice(_prepared->vm, _scheduler->slice);
+
+	pthread_mutex_lock(&_scheduler->lock);
+	++_scheduler->live;
+	enqueue(_scheduler, fiber);
+	pthread_cond_signal(&_scheduler->ready);
+	pthread_mutex_unlock(&_scheduler->lock);
+	return fiber;
+}
+
+void wait_fibers(scheduler_s* _scheduler)
+{
+	pthread_mutex_lock(&_scheduler->lock);
+	while(_scheduler->live > 0) {
+		pthread_cond_wait(&_scheduler->finished, &_scheduler->lock);
+	}
+	pthread_mutex_unlock(&_scheduler->lock);
+}
+
+void free_fiber(fiber_s* _fiber)
+{
+	free_prepared(_fiber->prepared);
+	FREE(fiber_s, _fiber, MEMORY_HANDLES);
+}
+
+//////////// static implementations
+static void* worker(void* _scheduler)
+{
+	scheduler_s* scheduler = (scheduler_s*)_scheduler;
+
+	pthread_mutex_lock(&scheduler->lock);
+	while(true) {
+		// queued fibers don't get another slice once the scheduler stops
+		if(scheduler->stopping) break;
+
+		fiber_s* fiber = dequeue(scheduler);
+		if(!fiber) {
+			pthread_cond_wait(&scheduler->ready, &scheduler->lock);
+			continue;
+		}
+		pthread_mutex_unlock(&scheduler->lock);
+
+		// the fiber belongs to this thread until it is queued again
+		interpret_result_e status = run_slice(fiber);
+
+		pthread_mutex_lock(&scheduler->lock);
+		if(status == INTERPRETER_YIELD && !scheduler->stopping) {
+			enqueue(scheduler, fiber);
+			continue;
+		}
+		if(status != INTERPRETER_YIELD) {
+			fiber->status = status;
+			--scheduler->live;
+			pthread_cond_broadcast(&scheduler->finished);
+		}
+	}
+	pthread_mutex_unlock(&scheduler->lock);
+	return NULL;
+}
+
+static interpret_result_e run_slice(fiber_s* _fiber)
+{
+	if(_fiber->quota != 0 && _fiber->slices == _fiber->quota) return INTERPRETER_QUOTA_EXCEEDED;
+	++_fiber->slices;
+
+	prepared_s* prepared = _fiber->prepared;
+	interpret_result_e status;
+	if(!_fiber->started) {
+		_fiber->started = true;
+		status = prepared_start(prepared);
+	} else {
+		status = vm_resume(prepared->vm);
+	}
+
+	if(status == INTERPRETER_OK) _fiber->result = prepared->vm->result;
+	return status;
+}
+
+static void enqueue(scheduler_s* _scheduler, fiber_s* _fiber)
+{
+	const uint priority = _fiber->priority;
+	_fiber->next = NULL;
+	if(_scheduler->tails[priority]) _scheduler->tails[priority]->next = _fiber;
+	else _scheduler->heads[priority] = _fiber;
+	_scheduler->tails[priority] = _fiber;
+}
+
+static fiber_s* dequeue(scheduler_s* _scheduler)
+{
+	for(uint priority = 0; priority < FIBER_PRIORITIES; ++priority) {
+		fiber_s* fiber = _scheduler->heads[priority];
+		if(!fiber) continue;
+
+		_scheduler->heads[priority] = fiber->next;
+		if(!fiber->next) _scheduler->tails[priority] = NULL;
+		fiber->next = NULL;
+		return fiber;
+	}
+	return NULL;
+}
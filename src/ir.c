@@ -0,0 +1,593 @@
+#include "../include/ir.h"
+
+//////////// static functions
+static int new_value(ir_s*, const ir_value_s*);
+static bool has_room(const ir_s*);
+static bool push_value(ir_s*, const int);
+static bool push_constant(ir_s*, const value_t, const uint);
+static bool is_constant(const ir_s*, const uint16_t);
+static bool is_number_constant(const ir_s*, const uint16_t, const double);
+static bool is_int_constant(const ir_s*, const uint16_t, const int64_t);
+static bool is_numeric(const ir_s*, const uint16_t);
+static bool is_double(const ir_s*, const uint16_t);
+static int negation(ir_s*, const uint16_t, const uint);
+static bool is_safe(const ir_s*, const uint16_t);
+static bool is_leaf(const ir_s*, const uint16_t);
+static bool same_value(const ir_value_s*, const ir_value_s*);
+static int simplify_binary(ir_s*, const opcode_e, const uint16_t, const uint16_t, const uint);
+static bool fold_binary(const opcode_e, const value_t, const value_t, value_t*);
+static int lower_root(ir_s*, chunk_s*, const uint16_t);
+static void emit_node(ir_s*, chunk_s*, const uint16_t, const bool);
+static void emit_instruction(chunk_s*, const uint8_t, const uint);
+static void emit_operand(chunk_s*, const uint8_t, const uint);
+static void count_uses(const ir_s*, const uint16_t, uint16_t*, bool*);
+static uint count_uses_below(const ir_s*, const uint16_t, const uint16_t, bool*);
+static const char* op_name(const opcode_e);
+static void dump(const ir_s*);
+
+//////////// static variables
+// lowering state, only valid inside lower_root()
+static struct {
+	uint16_t uses[IR_VALUES_MAX];
+	int position[IR_VALUES_MAX];	// stack position of a value kept as a temporary
+	int adopted;					// temporary used in place by its first user
+	bool adopted_used;
+	uint depth;						// values pushed since the root started
+	int last_op;					// offset of the last emitted opcode
+}lowering;
+
+//////////// implementations
+void init_ir(ir_s* _ir, const bool _dump)
+{
+	_ir->value_count = 0;
+	_ir->stack_size	 = 0;
+	_ir->dump		 = _dump;
+	_ir->error		 = false;
+}
+
+bool ir_empty(const ir_s* _ir)
+{
+	return _ir->stack_size == 0;
+}
+
+bool ir_constant(ir_s* _ir, const value_t _value, const uint _line)
+{
+	if(!has_room(_ir)) return false;
+	return push_constant(_ir, _value, _line);
+}
+
+bool ir_literal(ir_s* _ir, const opcode_e _op, const uint _line)
+{
+	if(!has_room(_ir)) return false;
+	switch(_op) {
+		case OP_NIL:   return push_constant(_ir, NIL_VAL, _line);
+		case OP_TRUE:  return push_constant(_ir, BOOL_VAL(true), _line);
+		case OP_FALSE: return push_constant(_ir, BOOL_VAL(false), _line);
+		default:	   return false;
+	}
+}
+
+bool ir_local(ir_s* _ir, const uint8_t _slot, const uint _line)
+{
+	if(!has_room(_ir)) return false;
+	ir_value_s value = {0};
+	value.kind = IR_LOCAL;
+	value.op   = OP_GET_LOCAL;
+	value.slot = _slot;
+	value.line = _line;
+	return push_value(_ir, new_value(_ir, &value));
+}
+
+// inputs can't change while the script runs, so they are shared like locals
+bool ir_input(ir_s* _ir, const uint8_t _index, const uint _line)
+{
+	if(!has_room(_ir)) return false;
+	ir_value_s value = {0};
+	value.kind = IR_INPUT;
+	value.op   = OP_GET_INPUT;
+	value.slot = _index;
+	value.line = _line;
+	return push_value(_ir, new_value(_ir, &value));
+}
+
+bool ir_unary(ir_s* _ir, const opcode_e _op, const uint _line)
+{
+	if(_ir->stack_size < 1 || !has_room(_ir)) return false;
+	const uint16_t operand = _ir->stack[_ir->stack_size - 1];
+	const ir_value_s* x = &_ir->values[operand];
+
+	int result = -1;
+	if(_op == OP_NEGATION && is_constant(_ir, operand) && IS_NUMERIC(x->constant)) {
+		--_ir->stack_size;
+		return push_constant(_ir, negate_value(x->constant), _line);
+	} else if(_op == OP_NOT && is_constant(_ir, operand)) {
+		--_ir->stack_size;
+		return push_constant(_ir, BOOL_VAL(is_falsey(x->constant)), _line);
+	} else if(_op == OP_NEGATION && x->kind == IR_UNARY && x->op == OP_NEGATION && is_double(_ir, x->left)) {
+		// --x == x for every double, including -0 and NaN. Not for ints,
+		// -INT64_MIN is a double and negating it again doesn't undo that
+		result = x->left;
+	} else {
+		ir_value_s value = {0};
+		value.kind = IR_UNARY;
+		value.op   = _op;
+		value.left = operand;
+		value.line = _line;
+		result = new_value(_ir, &value);
+	}
+
+	if(result == -1) return false;
+	_ir->stack[_ir->stack_size - 1] = (uint16_t)result;
+	return true;
+}
+
+bool ir_binary(ir_s* _ir, const opcode_e _op, const uint _line)
+{
+	if(_ir->stack_size < 2 || !has_room(_ir)) return false;
+	const uint16_t left	 = _ir->stack[_ir->stack_size - 2];
+	const uint16_t right = _ir->stack[_ir->stack_size - 1];
+
+	value_t folded;
+	if(is_constant(_ir, left) && is_constant(_ir, right)
+	   && fold_binary(_op, _ir->values[left].constant, _ir->values[right].constant, &folded)) {
+		_ir->stack_size -= 2;
+		return push_constant(_ir, folded, _line);
+	}
+
+	int result = simplify_binary(_ir, _op, left, right, _line);
+	if(result == -1) {
+		ir_value_s value = {0};
+		value.kind	= IR_BINARY;
+		value.op	= _op;
+		value.left	= left;
+		value.right = right;
+		value.line	= _line;
+		result = new_value(_ir, &value);
+	}
+
+	if(result == -1) return false;
+	--_ir->stack_size;
+	_ir->stack[_ir->stack_size - 1] = (uint16_t)result;
+	return true;
+}
+
+bool ir_drop(ir_s* _ir)
+{
+	if(_ir->stack_size == 0) return false;
+	// a value that may still raise a runtime error has to be computed
+	if(!is_safe(_ir, _ir->stack[_ir->stack_size - 1])) return false;
+
+	--_ir->stack_size;
+	return true;
+}
+
+int ir_lower(ir_s* _ir, chunk_s* _chunk)
+{
+	if(_ir->stack_size == 0) {
+		_ir->value_count = 0;
+		return -1;
+	}
+	if(_ir->dump) dump(_ir);
+
+	int last_comparison = -1;
+	for(uint i = 0; i < _ir->stack_size; ++i) {
+		last_comparison = lower_root(_ir, _chunk, _ir->stack[i]);
+	}
+
+	_ir->value_count = 0;
+	_ir->stack_size	 = 0;
+	return last_comparison;
+}
+
+//////////// static implementations
+
+// hash consing: a value that was computed before is reused, which is all
+// common subexpression elimination needs inside one side effect free region
+static int new_value(ir_s* _ir, const ir_value_s* _value)
+{
+	for(uint i = 0; i < _ir->value_count; ++i) {
+		if(same_value(&_ir->values[i], _value)) return (int)i;
+	}
+	if(_ir->value_count == IR_VALUES_MAX) return -1;
+
+	_ir->values[_ir->value_count] = *_value;
+	_ir->values[_ir->value_count].literal = -1;
+	return (int)_ir->value_count++;
+}
+
+// checked before anything is popped, so a value that doesn't fit leaves
+// the IR untouched for the caller to lower
+static bool has_room(const ir_s* _ir)
+{
+	return _ir->value_count < IR_VALUES_MAX && _ir->stack_size < IR_STACK_MAX;
+}
+
+static bool push_value(ir_s* _ir, const int _value)
+{
+	if(_value == -1 || _ir->stack_size == IR_STACK_MAX) return false;
+	_ir->stack[_ir->stack_size++] = (uint16_t)_value;
+	return true;
+}
+
+static bool push_constant(ir_s* _ir, const value_t _constant, const uint _line)
+{
+	ir_value_s value = {0};
+	value.kind	   = IR_CONSTANT;
+	value.constant = _constant;
+	value.line	   = _line;
+	switch(_constant.type) {
+		case VAL_NIL:  value.op = OP_NIL; break;
+		case VAL_BOOL: value.op = AS_BOOL(_constant) ? OP_TRUE : OP_FALSE; break;
+		default:	   value.op = OP_CONSTANT; break;
+	}
+	return push_value(_ir, new_value(_ir, &value));
+}
+
+static bool is_constant(const ir_s* _ir, const uint16_t _value)
+{
+	return _ir->values[_value].kind == IR_CONSTANT;
+}
+
+// compares bit patterns, so -0 and 0 are different constants
+static bool is_number_constant(const ir_s* _ir, const uint16_t _value, const double _number)
+{
+	const ir_value_s* value = &_ir->values[_value];
+	if(value->kind != IR_CONSTANT || !IS_NUMBER(value->constant)) return false;
+	return memcmp(&AS_NUMBER(value->constant), &_number, sizeof(double)) == 0;
+}
+
+static bool is_int_constant(const ir_s* _ir, const uint16_t _value, const int64_t _number)
+{
+	const ir_value_s* value = &_ir->values[_value];
+	return value->kind == IR_CONSTANT && IS_INT(value->constant) && AS_INT(value->constant) == _number;
+}
+
+// produces an int or a double or fails at runtime, never anything else.
+// Arithmetic on an array makes an array, but arrays are immutable doubles,
+// so whatever holds for a double here holds for each of their elements.
+static bool is_numeric(const ir_s* _ir, const uint16_t _value)
+{
+	const ir_value_s* value = &_ir->values[_value];
+	switch(value->kind) {
+		case IR_CONSTANT: return IS_NUMERIC(value->constant);
+		case IR_LOCAL:
+		case IR_INPUT:	  return false;
+		case IR_UNARY:	  return value->op == OP_NEGATION;
+		case IR_BINARY:
+			return value->op == OP_ADD || value->op == OP_SUBTRACT
+				|| value->op == OP_MULTIPLY || value->op == OP_DIVIDE;
+	}
+	return false;
+}
+
+// produces a double (or an array) or fails at runtime
+static bool is_double(const ir_s* _ir, const uint16_t _value)
+{
+	const ir_value_s* value = &_ir->values[_value];
+	switch(value->kind) {
+		case IR_CONSTANT: return IS_NUMBER(value->constant);
+		case IR_LOCAL:
+		case IR_INPUT:	  return false;
+		case IR_UNARY:	  return value->op == OP_NEGATION && is_double(_ir, value->left);
+		case IR_BINARY:
+			if(value->op == OP_DIVIDE) return true;
+			if(value->op != OP_ADD && value->op != OP_SUBTRACT && value->op != OP_MULTIPLY) return false;
+			// one double side makes the result a double
+			return (is_double(_ir, value->left) && is_numeric(_ir, value->right))
+				|| (is_numeric(_ir, value->left) && is_double(_ir, value->right));
+	}
+	return false;
+}
+
+static int negation(ir_s* _ir, const uint16_t _operand, const uint _line)
+{
+	ir_value_s value = {0};
+	value.kind = IR_UNARY;
+	value.op   = OP_NEGATION;
+	value.left = _operand;
+	value.line = _line;
+	return new_value(_ir, &value);
+}
+
+// can't raise a runtime error
+static bool is_safe(const ir_s* _ir, const uint16_t _value)
+{
+	const ir_value_s* value = &_ir->values[_value];
+	switch(value->kind) {
+		case IR_CONSTANT:
+		case IR_LOCAL:
+		case IR_INPUT:
+			return true;
+		case IR_UNARY:
+			if(!is_safe(_ir, value->left)) return false;
+			return value->op == OP_NOT || (is_numeric(_ir, value->left) && is_constant(_ir, value->left));
+		case IR_BINARY:
+			if(!is_safe(_ir, value->left) || !is_safe(_ir, value->right)) return false;
+			if(value->op == OP_EQUAL || value->op == OP_NOT_EQUAL) return true;
+			// a safe numeric value is made of number constants only
+			return is_numeric(_ir, value->left) && is_numeric(_ir, value->right);
+	}
+	return false;
+}
+
+static bool is_leaf(const ir_s* _ir, const uint16_t _value)
+{
+	const ir_kind_e kind = _ir->values[_value].kind;
+	return kind == IR_CONSTANT || kind == IR_LOCAL || kind == IR_INPUT;
+}
+
+static bool same_value(const ir_value_s* _a, const ir_value_s* _b)
+{
+	if(_a->kind != _b->kind || _a->op != _b->op) return false;
+	switch(_a->kind) {
+		case IR_CONSTANT:
+			return _a->constant.type == _b->constant.type
+				&& memcmp(&_a->constant.as, &_b->constant.as, sizeof(_a->constant.as)) == 0;
+		case IR_LOCAL:
+		case IR_INPUT:	return _a->slot == _b->slot;
+		case IR_UNARY:	return _a->left == _b->left;
+		case IR_BINARY: return _a->left == _b->left && _a->right == _b->right;
+	}
+	return false;
+}
+
+// identities that hold for every value the other side can have at runtime,
+// otherwise they would hide a type error or change an int into a double.
+// With an int constant they hold for ints and doubles alike (x*1 of an int
+// stays an int, of a double it is exact), with a double constant only when
+// the other side is known to be a double. x+0 is never one of them, -0 + 0
+// is +0, but x + -0 and x - 0 are.
+static int simplify_binary(ir_s* _ir, const opcode_e _op, const uint16_t _left, const uint16_t _right, const uint _line)
+{
+	switch(_op) {
+		case OP_MULTIPLY:
+			if(is_int_constant(_ir, _right, 1) && is_numeric(_ir, _left)) return _left;
+			if(is_int_constant(_ir, _left, 1) && is_numeric(_ir, _right)) return _right;
+			if(is_number_constant(_ir, _right, 1.0) && is_double(_ir, _left)) return _left;
+			if(is_number_constant(_ir, _left, 1.0) && is_double(_ir, _right)) return _right;
+			// x * -1 overflows exactly where -x does
+			if(is_int_constant(_ir, _right, -1) && is_numeric(_ir, _left)) return negation(_ir, _left, _line);
+			if(is_number_constant(_ir, _right, -1.0) && is_double(_ir, _left)) return negation(_ir, _left, _line);
+			break;
+		case OP_DIVIDE:
+			if((is_int_constant(_ir, _right, 1) || is_number_constant(_ir, _right, 1.0)) && is_double(_ir, _left)) return _left;
+			break;
+		case OP_ADD:
+			if(is_number_constant(_ir, _right, -0.0) && is_double(_ir, _left)) return _left;
+			if(is_number_constant(_ir, _left, -0.0) && is_double(_ir, _right)) return _right;
+			break;
+		case OP_SUBTRACT:
+			if(is_int_constant(_ir, _right, 0) && is_numeric(_ir, _left)) return _left;
+			if(is_number_constant(_ir, _right, 0.0) && is_double(_ir, _left)) return _left;
+			break;
+		default: break;
+	}
+	return -1;
+}
+
+// same semantics as run(), anything that would fail is left for runtime
+static bool fold_binary(const opcode_e _op, const value_t _a, const value_t _b, value_t* _result)
+{
+	if(_op == OP_EQUAL)		{ *_result = BOOL_VAL(values_equal(_a, _b));  return true; }
+	if(_op == OP_NOT_EQUAL) { *_result = BOOL_VAL(!values_equal(_a, _b)); return true; }
+
+	if(!IS_NUMERIC(_a) || !IS_NUMERIC(_b)) return false;
+	const int order = compare_values(_a, _b);
+
+	switch(_op) {
+		case OP_ADD:		   *_result = add_values(_a, _b);				   return true;
+		case OP_SUBTRACT:	   *_result = subtract_values(_a, _b);			   return true;
+		case OP_MULTIPLY:	   *_result = multiply_values(_a, _b);			   return true;
+		case OP_DIVIDE:		   *_result = divide_values(_a, _b);			   return true;
+		case OP_LESS:		   *_result = BOOL_VAL(order == -1);			   return true;
+		case OP_LESS_EQUAL:	   *_result = BOOL_VAL(order == -1 || order == 0); return true;
+		case OP_GREATER:	   *_result = BOOL_VAL(order == 1);				   return true;
+		case OP_GREATER_EQUAL: *_result = BOOL_VAL(order == 1 || order == 0);  return true;
+		default:			   return false;
+	}
+}
+
+// Values used more than once in the tree of the root are computed first and
+// kept on the stack as temporaries, every use copies them up with OP_PICK and
+// OP_SLIDE drops them from under the result at the end. The last temporary
+// can often be consumed in place by its first user instead, when all the
+// other uses are evaluated before that user runs. Values nothing reaches are
+// never emitted, which is the dead code elimination.
+static int lower_root(ir_s* _ir, chunk_s* _chunk, const uint16_t _root)
+{
+	bool visited[IR_VALUES_MAX] = {false};
+	memset(lowering.uses, 0, sizeof(lowering.uses));
+	for(uint i = 0; i < _ir->value_count; ++i) lowering.position[i] = -1;
+	lowering.adopted	  = -1;
+	lowering.adopted_used = false;
+	lowering.depth		  = 0;
+	lowering.last_op	  = -1;
+
+	count_uses(_ir, _root, lowering.uses, visited);
+
+	// ids are handed out in definition order, so this is a topological order
+	uint temporaries = 0;
+	int last_temporary = -1;
+	for(uint i = 0; i < _ir->value_count; ++i) {
+		if(!visited[i] || lowering.uses[i] < 2 || is_leaf(_ir, (uint16_t)i)) continue;
+		emit_node(_ir, _chunk, (uint16_t)i, true);
+		lowering.position[i] = (int)lowering.depth - 1;
+		last_temporary = (int)i;
+		++temporaries;
+	}
+
+	if(last_temporary != -1) {
+		uint16_t parent = _root;
+		uint16_t node = _root;
+		while(!is_leaf(_ir, node) && lowering.position[node] == -1) {
+			parent = node;
+			node = _ir->values[node].left;
+		}
+		bool seen[IR_VALUES_MAX] = {false};
+		if(node == last_temporary && parent != node
+		   && count_uses_below(_ir, parent, node, seen) == lowering.uses[node]) {
+			lowering.adopted = last_temporary;
+		}
+	}
+
+	emit_node(_ir, _chunk, _root, false);
+
+	const uint leftover = temporaries - (lowering.adopted == -1 ? 0 : 1);
+	if(leftover > 0) {
+		emit_instruction(_chunk, OP_SLIDE, _ir->values[_root].line);
+		emit_operand(_chunk, (uint8_t)leftover, _ir->values[_root].line);
+		return -1;
+	}
+
+	switch(_ir->values[_root].op) {
+		case OP_EQUAL:
+		case OP_NOT_EQUAL:
+		case OP_LESS:
+		case OP_LESS_EQUAL:
+		case OP_GREATER:
+		case OP_GREATER_EQUAL:
+			return _ir->values[_root].kind == IR_BINARY ? lowering.last_op : -1;
+		default:
+			return -1;
+	}
+}
+
+static void emit_node(ir_s* _ir, chunk_s* _chunk, const uint16_t _node, const bool _defining)
+{
+	ir_value_s* value = &_ir->values[_node];
+
+	if(!_defining && lowering.position[_node] != -1) {
+		if(_node == lowering.adopted && !lowering.adopted_used) {
+			lowering.adopted_used = true;
+			return;
+		}
+		emit_instruction(_chunk, OP_PICK, value->line);
+		emit_operand(_chunk, (uint8_t)(lowering.depth - 1 - lowering.position[_node]), value->line);
+		++lowering.depth;
+		return;
+	}
+
+	switch(value->kind) {
+		case IR_CONSTANT: {
+			if(value->op != OP_CONSTANT) {
+				emit_instruction(_chunk, value->op, value->line);
+			} else {
+				if(value->literal == -1) value->literal = append_literal(_chunk, value->constant);
+				if(value->literal > UINT8_MAX) _ir->error = true;
+				emit_instruction(_chunk, OP_CONSTANT, value->line);
+				emit_operand(_chunk, (uint8_t)value->literal, value->line);
+			}
+			++lowering.depth;
+			break;
+		}
+		case IR_LOCAL:
+		case IR_INPUT: {
+			emit_instruction(_chunk, value->op, value->line);
+			emit_operand(_chunk, value->slot, value->line);
+			++lowering.depth;
+			break;
+		}
+		case IR_UNARY: {
+			emit_node(_ir, _chunk, value->left, false);
+			emit_instruction(_chunk, value->op, value->line);
+			break;
+		}
+		case IR_BINARY: {
+			emit_node(_ir, _chunk, value->left, false);
+			emit_node(_ir, _chunk, value->right, false);
+			emit_instruction(_chunk, value->op, value->line);
+			--lowering.depth;
+			break;
+		}
+	}
+}
+
+static void emit_instruction(chunk_s* _chunk, const uint8_t _opcode, const uint _line)
+{
+	lowering.last_op = (int)_chunk->size;
+	append_chunk(_chunk, _opcode, _line);
+}
+
+static void emit_operand(chunk_s* _chunk, const uint8_t _operand, const uint _line)
+{
+	append_chunk(_chunk, _operand, _line);
+}
+
+// edges from each distinct value, a shared value is only evaluated once
+static void count_uses(const ir_s* _ir, const uint16_t _value, uint16_t* _uses, bool* _visited)
+{
+	if(_visited[_value]) return;
+	_visited[_value] = true;
+
+	const ir_value_s* value = &_ir->values[_value];
+	if(value->kind == IR_UNARY || value->kind == IR_BINARY) {
+		++_uses[value->left];
+		count_uses(_ir, value->left, _uses, _visited);
+	}
+	if(value->kind == IR_BINARY) {
+		++_uses[value->right];
+		count_uses(_ir, value->right, _uses, _visited);
+	}
+}
+
+// uses of _target coming from values evaluated as part of _value, stopping
+// at temporaries since those were computed before the root
+static uint count_uses_below(const ir_s* _ir, const uint16_t _value, const uint16_t _target, bool* _seen)
+{
+	if(_seen[_value] || _value == _target) return 0;
+	_seen[_value] = true;
+
+	const ir_value_s* value = &_ir->values[_value];
+	uint count = 0;
+	if(value->kind == IR_UNARY || value->kind == IR_BINARY) {
+		if(value->left == _target) ++count;
+		else if(lowering.position[value->left] == -1) count += count_uses_below(_ir, value->left, _target, _seen);
+	}
+	if(value->kind == IR_BINARY) {
+		if(value->right == _target) ++count;
+		else if(lowering.position[value->right] == -1) count += count_uses_below(_ir, value->right, _target, _seen);
+	}
+	return count;
+}
+
+static const char* op_name(const opcode_e _op)
+{
+	switch(_op) {
+		case OP_ADD:		   return "add";
+		case OP_SUBTRACT:	   return "subtract";
+		case OP_MULTIPLY:	   return "multiply";
+		case OP_DIVIDE:		   return "divide";
+		case OP_NEGATION:	   return "negation";
+		case OP_NOT:		   return "not";
+		case OP_EQUAL:		   return "equal";
+		case OP_NOT_EQUAL:	   return "not_equal";
+		case OP_LESS:		   return "less";
+		case OP_LESS_EQUAL:	   return "less_equal";
+		case OP_GREATER:	   return "greater";
+		case OP_GREATER_EQUAL: return "greater_equal";
+		default:			   return "?";
+	}
+}
+
+static void dump(const ir_s* _ir)
+{
+	printf("====== ir [start] ======\n");
+	for(uint i = 0; i < _ir->value_count; ++i) {
+		const ir_value_s* value = &_ir->values[i];
+		printf("v%-3d = ", i);
+		switch(value->kind) {
+			case IR_CONSTANT:
+				printf("constant ");
+				print_value(value->constant);
+				printf("\n");
+				break;
+			case IR_LOCAL:	printf("local %d\n", value->slot); break;
+			case IR_INPUT:	printf("input %d\n", value->slot); break;
+			case IR_UNARY:	printf("%s v%d\n", op_name(value->op), value->left); break;
+			case IR_BINARY: printf("%s v%d, v%d\n", op_name(value->op), value->left, value->right); break;
+		}
+	}
+	printf("live:");
+	for(uint i = 0; i < _ir->stack_size; ++i) printf(" v%d", _ir->stack[i]);
+	printf("\n====== ir [end] ========\n");
+}
@@ -2,28 +2,111 @@
 #include "../include/chunk.h"
 #include "../include/debug.h"
 #include "../include/vm.h"
+#include "../include/compiler.h"
+#include "../include/cache.h"
+#include "../include/aot.h"
+#include "../include/memory.h"
+#include "../include/perf.h"
+#include "../include/snapshot.h"
 
-static char* read_file(const char*);
+static char* read_file(const char*, size_t*);
 
 static void repl();
-static void run_file(const char*);
+static void run_pipe();
+static int run_file(const char*);
 
 int main(int argc, char** argv)
 {
+	compiler_options_s options = {.optimization_level = 0, .dump_ir = false, .lazy = false, .token_stream = false};
+	const char* file_name = NULL;
+	bool show_cache_stats = false;
+	bool show_memory_stats = false;
+	bool check_leaks = false;
+	bool show_lazy_stats = false;
+	bool measure = false;
+	const char* snapshot = NULL;
+	const char* save_to = NULL;
+	aot_options_s aot = {.enabled = false, .directory = NULL, .compiler = NULL};
+	for(int i = 1; i < argc; i++) {
+		const char* arg = *(argv + i);
+		if(strcmp(arg, "-O0") == 0) {
+			options.optimization_level = 0;
+		} else if(strcmp(arg, "-O1") == 0) {
+			options.optimization_level = 1;
+		} else if(strcmp(arg, "--dump-ir") == 0) {
+			options.dump_ir = true;
+		} else if(strcmp(arg, "--lazy") == 0) {
+			options.lazy = true;
+		} else if(strcmp(arg, "--token-stream") == 0) {
+			options.token_stream = true;
+		} else if(strcmp(arg, "--lazy-stats") == 0) {
+			show_lazy_stats = true;
+		} else if(strncmp(arg, "--cache-budget=", 15) == 0) {
+			set_cache_budget(strtoull(arg + 15, NULL, 10));
+		} else if(strcmp(arg, "--cache-stats") == 0) {
+			show_cache_stats = true;
+		} else if(strcmp(arg, "--memory-stats") == 0) {
+			show_memory_stats = true;
+		} else if(strcmp(arg, "--check-leaks") == 0) {
+			check_leaks = true;
+		} else if(strcmp(arg, "--perf") == 0) {
+			measure = true;
+		} else if(strncmp(arg, "--snapshot=", 11) == 0) {
+			snapshot = arg + 11;
+		} else if(strncmp(arg, "--save-snapshot=", 16) == 0) {
+			save_to = arg + 16;
+		} else if(strcmp(arg, "--dispatch=plain") == 0) {
+			set_dispatch(DISPATCH_PLAIN);
+		} else if(strcmp(arg, "--dispatch=cached") == 0) {
+			set_dispatch(DISPATCH_CACHED);
+		} else if(strcmp(arg, "--aot") == 0) {
+			aot.enabled = true;
+		} else if(strncmp(arg, "--aot-dir=", 10) == 0) {
+			aot.directory = arg + 10;
+		} else if(!file_name && *arg != '-') {
+			file_name = arg;
+		} else {
+			printf("usage: prog [-O0|-O1] [--dump-ir] [--lazy] [--lazy-stats] [--token-stream] [--cache-budget=<bytes>] [--cache-stats] [--memory-stats] [--check-leaks] [--perf] [--dispatch=plain|cached] [--snapshot=<image>] [--save-snapshot=<image>] [--aot] [--aot-dir=<dir>] [file_name]\n");
+			exit(-1);
+		}
+	}
+
+	set_compiler_options(options);
+	set_aot_options(aot);
 	vm_init();
+	// without counters the report still has timings
+	if(measure) (void)perf_init();
+	// a bad image only costs the time it saves, the sources still compile
+	if(snapshot) {
+		snapshot_result_e loaded = load_snapshot(snapshot, NULL);
+		if(loaded != SNAPSHOT_OK) fprintf(stderr, "snapshot %s not loaded: %s\n", snapshot, snapshot_result_message(loaded));
+	}
 
-	if(argc == 1) {
+	int exit_code = 0;
+	if(!file_name && isatty(STDIN_FILENO)) {
 		repl();
-	} else if(argc == 2) {
-		const char* file_name = *(argv + 1);
-		run_file(file_name);
+	} else if(!file_name) {
+		run_pipe();
 	} else {
-		printf("usage: prog [file_name]\n");
-		exit(-1);
+		exit_code = run_file(file_name);
 	}
 
+	if(save_to) {
+		snapshot_result_e saved = save_snapshot(save_to);
+		if(saved != SNAPSHOT_OK) {
+			fprintf(stderr, "snapshot %s not saved: %s\n", save_to, snapshot_result_message(saved));
+			if(exit_code == 0) exit_code = 74;
+		}
+	}
+	if(show_lazy_stats) print_lazy_stats(stderr);
+	if(show_cache_stats) print_cache_stats(stderr);
+	if(show_memory_stats) print_memory_stats(stderr);
+	print_perf_report(stderr);
+	perf_free();
 	vm_free();
-	return 0;
+	// everything the interpreter allocated is given back by now
+	if(check_leaks && !check_memory_leaks(stderr) && exit_code == 0) exit_code = 70;
+	return exit_code;
 }
 
 static void repl()
@@ -41,17 +124,30 @@ static void repl()
 	}
 }
 
-static void run_file(const char* _file_name)
+// every line is a script of its own, like the repl without the prompt
+static void run_pipe()
 {
-	char* source_code = read_file(_file_name);
+	char line[1024];
+	while(fgets(line, sizeof(line), stdin)) {
+		vm_interpret(line);
+	}
+}
+
+static int run_file(const char* _file_name)
+{
+	size_t size;
+	char* source_code = read_file(_file_name, &size);
 	interpret_result_e result = vm_interpret(source_code);
-	free(source_code);
+	FREE_ARRAY(char, source_code, size, MEMORY_SCRATCH);
 
-	if(result == INTERPRETER_COMPILER_ERROR) exit(65);
-	if(result == INTERPRETER_RUNTIME_ERROR) exit(70);
+	if(result == INTERPRETER_COMPILER_ERROR) return 65;
+	if(result == INTERPRETER_VERIFIER_ERROR) return 70;
+	if(result == INTERPRETER_RUNTIME_ERROR) return 70;
+	return 0;
 }
 
-static char* read_file(const char* _file_name)
+// _size is what was allocated, to give it back
+static char* read_file(const char* _file_name, size_t* _size)
 {
 	FILE* file = fopen(_file_name, "r");
 	if(!file) {
@@ -62,7 +158,8 @@ static char* read_file(const char* _file_name)
 	int file_size = ftell(file);
 	rewind(file);
 
-	char* file_contents = (char*)malloc(sizeof(char) * file_size + 1);
+	*_size = file_size + 1;
+	char* file_contents = ALLOCATE(char, *_size, MEMORY_SCRATCH);
 	int bytes_read = fread(file_contents, sizeof(char), file_size, file);
 	file_contents[bytes_read] = '\0';
 
@@ -0,0 +1,174 @@
+#include "../include/memory.h"
+
+//////////// static types
+typedef struct {
+	size_t live;
+	size_t peak;
+	memory_stats_s subsystems[MEMORY_SUBSYSTEMS];
+}memory_s;
+
+//////////// static variables
+static memory_s memory;
+
+//////////// static functions
+static void account(memory_stats_s*, const size_t, const size_t);
+static void raise_peak(size_t*, const size_t);
+static uint size_class(const size_t);
+
+//////////// implementations
+void* reallocate(void* _pointer, const size_t _old_size, const size_t _new_size, const memory_subsystem_e _subsystem)
+{
+	// freeing what was never allocated, like a chunk freed twice
+	if(!_pointer && _new_size == 0) return NULL;
+	account(&memory.subsystems[_subsystem], _old_size, _new_size);
+
+	if(_new_size == 0) {
+		free(_pointer);
+		return NULL;
+	}
+
+	void* result = realloc(_pointer, _new_size);
+	if(!result) {
+		fprintf(stderr, "out of memory allocating %zu bytes for %s\n", _new_size, memory_subsystem_name(_subsystem));
+		exit(74);
+	}
+	return result;
+}
+
+void* allocate_zeroed(const size_t _size, const memory_subsystem_e _subsystem)
+{
+	void* result = reallocate(NULL, 0, _size, _subsystem);
+	memset(result, 0, _size);
+	return result;
+}
+
+void* allocate_aligned(const size_t _size, const size_t _alignment, const memory_subsystem_e _subsystem)
+{
+	account(&memory.subsystems[_subsystem], 0, _size);
+	// aligned_alloc() only takes whole multiples of the alignment
+	void* result = aligned_alloc(_alignment, (_size + _alignment - 1) & ~(_alignment - 1));
+	if(!result) {
+		fprintf(stderr, "out of memory allocating %zu bytes for %s\n", _size, memory_subsystem_name(_subsystem));
+		exit(74);
+	}
+	return result;
+}
+
+void free_aligned(void* _pointer, const size_t _size, const memory_subsystem_e _subsystem)
+{
+	if(!_pointer) return;
+	account(&memory.subsystems[_subsystem], _size, 0);
+	free(_pointer);
+}
+
+memory_stats_s memory_stats(const memory_subsystem_e _subsystem)
+{
+	const memory_stats_s* stats = &memory.subsystems[_subsystem];
+	memory_stats_s copy;
+	copy.live		 = __atomic_load_n(&stats->live, __ATOMIC_RELAXED);
+	copy.peak		 = __atomic_load_n(&stats->peak, __ATOMIC_RELAXED);
+	copy.allocations = __atomic_load_n(&stats->allocations, __ATOMIC_RELAXED);
+	copy.frees		 = __atomic_load_n(&stats->frees, __ATOMIC_RELAXED);
+	for(uint i = 0; i < MEMORY_SIZE_CLASSES; ++i) {
+		copy.size_classes[i] = __atomic_load_n(&stats->size_classes[i], __ATOMIC_RELAXED);
+	}
+	return copy;
+}
+
+size_t memory_live()
+{
+	return __atomic_load_n(&memory.live, __ATOMIC_RELAXED);
+}
+
+size_t memory_peak()
+{
+	return __atomic_load_n(&memory.peak, __ATOMIC_RELAXED);
+}
+
+const char* memory_subsystem_name(const memory_subsystem_e _subsystem)
+{
+	switch(_subsystem) {
+		case MEMORY_BYTECODE:	return "bytecode";
+		case MEMORY_LINES:		return "line table";
+		case MEMORY_LITERALS:	return "literals";
+		case MEMORY_TOKENS:		return "tokens";
+		case MEMORY_FUNCTIONS:	return "functions";
+		case MEMORY_INPUTS:		return "inputs";
+		case MEMORY_STACK:		return "stack";
+		case MEMORY_CACHE:		return "cache";
+		case MEMORY_HANDLES:	return "handles";
+		case MEMORY_SCRATCH:	return "scratch";
+		case MEMORY_OBJECTS:	return "objects";
+		default:				return "undefined subsystem";
+	}
+}
+
+void print_memory_stats(FILE* _file)
+{
+	fprintf(_file, "memory: %zu bytes live, %zu peak\n", memory_live(), memory_peak());
+	fprintf(_file, "  %-12s %12s %12s %10s %10s  sizes (16, 32, 64, ... bytes)\n",
+			"subsystem", "live", "peak", "allocs", "frees");
+	for(uint i = 0; i < MEMORY_SUBSYSTEMS; ++i) {
+		memory_stats_s stats = memory_stats(i);
+		if(stats.allocations == 0) continue;
+
+		fprintf(_file, "  %-12s %12zu %12zu %10" PRIu64 " %10" PRIu64 " ",
+				memory_subsystem_name(i), stats.live, stats.peak, stats.allocations, stats.frees);
+		// up to the largest class in use, the tail is all zeros
+		uint last = MEMORY_SIZE_CLASSES;
+		while(last > 0 && stats.size_classes[last - 1] == 0) --last;
+		for(uint size = 0; size < last; ++size) {
+			fprintf(_file, " %" PRIu64, stats.size_classes[size]);
+		}
+		fprintf(_file, "\n");
+	}
+}
+
+bool check_memory_leaks(FILE* _file)
+{
+	bool clean = true;
+	for(uint i = 0; i < MEMORY_SUBSYSTEMS; ++i) {
+		memory_stats_s stats = memory_stats(i);
+		if(stats.live == 0) continue;
+
+		fprintf(_file, "leak: %zu bytes of %s still live (%" PRIu64 " allocations, %" PRIu64 " frees)\n",
+				stats.live, memory_subsystem_name(i), stats.allocations, stats.frees);
+		clean = false;
+	}
+	return clean;
+}
+
+//////////// static implementations
+static void account(memory_stats_s* _stats, const size_t _old_size, const size_t _new_size)
+{
+	if(_new_size == 0) {
+		if(!_old_size) return;
+		__atomic_add_fetch(&_stats->frees, 1, __ATOMIC_RELAXED);
+	} else {
+		__atomic_add_fetch(&_stats->allocations, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&_stats->size_classes[size_class(_new_size)], 1, __ATOMIC_RELAXED);
+	}
+
+	if(_new_size >= _old_size) {
+		const size_t grown = _new_size - _old_size;
+		raise_peak(&_stats->peak, __atomic_add_fetch(&_stats->live, grown, __ATOMIC_RELAXED));
+		raise_peak(&memory.peak, __atomic_add_fetch(&memory.live, grown, __ATOMIC_RELAXED));
+	} else {
+		const size_t shrunk = _old_size - _new_size;
+		__atomic_sub_fetch(&_stats->live, shrunk, __ATOMIC_RELAXED);
+		__atomic_sub_fetch(&memory.live, shrunk, __ATOMIC_RELAXED);
+	}
+}
+
+static void raise_peak(size_t* _peak, const size_t _live)
+{
+	size_t peak = __atomic_load_n(_peak, __ATOMIC_RELAXED);
+	while(_live > peak && !__atomic_compare_exchange_n(_peak, &peak, _live, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static uint size_class(const size_t _size)
+{
+	uint size = 0;
+	while(size < MEMORY_SIZE_CLASSES - 1 && _size > ((size_t)16 << size)) ++size;
+	return size;
+}
@@ -0,0 +1,124 @@
+#include "../include/native.h"
+#include "../include/array.h"
+
+#include <math.h>
+
+//////////// static functions
+static bool define(const native_s*);
+static bool native_sum(value_t*, value_t*);
+static bool native_dot(value_t*, value_t*);
+static bool native_min(value_t*, value_t*);
+static bool native_max(value_t*, value_t*);
+static bool native_len(value_t*, value_t*);
+
+//////////// variables
+native_s natives[NATIVES_MAX] = {
+	{"sqrt", 1, NATIVE_NUMBER_1, {.number_1 = sqrt}},
+	{"exp",	 1, NATIVE_NUMBER_1, {.number_1 = exp}},
+	{"log",	 1, NATIVE_NUMBER_1, {.number_1 = log}},
+	{"pow",	 2, NATIVE_NUMBER_2, {.number_2 = pow}},
+	{"min",	 2, NATIVE_NUMBER_2, {.number_2 = fmin}},
+	{"max",	 2, NATIVE_NUMBER_2, {.number_2 = fmax}},
+	{"sum",	 1, NATIVE_GENERIC,	 {.generic = native_sum}},
+	{"dot",	 2, NATIVE_GENERIC,	 {.generic = native_dot}},
+	{"min",	 1, NATIVE_GENERIC,	 {.generic = native_min}},
+	{"max",	 1, NATIVE_GENERIC,	 {.generic = native_max}},
+	{"len",	 1, NATIVE_GENERIC,	 {.generic = native_len}},
+};
+uint native_count = 11;
+
+//////////// implementations
+bool define_native(const char* _name, const uint8_t _arity, native_fn_t _function)
+{
+	native_s native = {_name, _arity, NATIVE_GENERIC, {.generic = _function}};
+	return define(&native);
+}
+
+bool define_native_number_1(const char* _name, native_number_1_t _function)
+{
+	native_s native = {_name, 1, NATIVE_NUMBER_1, {.number_1 = _function}};
+	return define(&native);
+}
+
+bool define_native_number_2(const char* _name, native_number_2_t _function)
+{
+	native_s native = {_name, 2, NATIVE_NUMBER_2, {.number_2 = _function}};
+	return define(&native);
+}
+
+int find_native(const char* _name, const uint _length)
+{
+	for(uint i = 0; i < native_count; ++i) {
+		if(strlen(natives[i].name) == _length && memcmp(natives[i].name, _name, _length) == 0) {
+			return (int)i;
+		}
+	}
+	return -1;
+}
+
+int resolve_native(const char* _name, const uint _length, const uint8_t _arity)
+{
+	for(uint i = 0; i < native_count; ++i) {
+		if(natives[i].arity == _arity && strlen(natives[i].name) == _length && memcmp(natives[i].name, _name, _length) == 0) {
+			return (int)i;
+		}
+	}
+	return -1;
+}
+
+const char* native_name(const uint _index)
+{
+	return _index < native_count ? natives[_index].name : "?";
+}
+
+//////////// static implementations
+static bool define(const native_s* _native)
+{
+	if(native_count == NATIVES_MAX) return false;
+	if(resolve_native(_native->name, strlen(_native->name), _native->arity) != -1) return false;
+
+	natives[native_count++] = *_native;
+	return true;
+}
+
+// the reductions fail on anything but arrays, see array.h for how they round
+static bool native_sum(value_t* _arguments, value_t* _result)
+{
+	if(!IS_ARRAY(_arguments[0])) return false;
+	const array_s* array = AS_ARRAY(_arguments[0]);
+	*_result = NUMBER_VAL(array_sum(array->data, array->length));
+	return true;
+}
+
+static bool native_dot(value_t* _arguments, value_t* _result)
+{
+	if(!IS_ARRAY(_arguments[0]) || !IS_ARRAY(_arguments[1])) return false;
+	const array_s* a = AS_ARRAY(_arguments[0]);
+	const array_s* b = AS_ARRAY(_arguments[1]);
+	if(a->length != b->length) return false;
+	*_result = NUMBER_VAL(array_dot(a->data, b->data, a->length));
+	return true;
+}
+
+static bool native_min(value_t* _arguments, value_t* _result)
+{
+	if(!IS_ARRAY(_arguments[0]) || AS_ARRAY(_arguments[0])->length == 0) return false;
+	const array_s* array = AS_ARRAY(_arguments[0]);
+	*_result = NUMBER_VAL(array_min(array->data, array->length));
+	return true;
+}
+
+static bool native_max(value_t* _arguments, value_t* _result)
+{
+	if(!IS_ARRAY(_arguments[0]) || AS_ARRAY(_arguments[0])->length == 0) return false;
+	const array_s* array = AS_ARRAY(_arguments[0]);
+	*_result = NUMBER_VAL(array_max(array->data, array->length));
+	return true;
+}
+
+static bool native_len(value_t* _arguments, value_t* _result)
+{
+	if(!IS_ARRAY(_arguments[0])) return false;
+	*_result = INT_VAL(AS_ARRAY(_arguments[0])->length);
+	return true;
+}
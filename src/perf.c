@@ -0,0 +1,243 @@
+#include "../include/perf.h"
+
+#include <errno.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+//////////// static types
+typedef struct {
+	bool initialized;
+	int fds[PERF_COUNTERS];		// -1 where the counter couldn't be opened
+	int errors[PERF_COUNTERS];	// errno of the failed perf_event_open()
+	uint64_t begun[PERF_PHASES][PERF_COUNTERS];
+	uint64_t begun_at[PERF_PHASES];
+	perf_totals_s totals[PERF_PHASES];
+}perf_s;
+
+//////////// static variables
+static perf_s perf = {.initialized = false};
+
+//////////// static functions
+static int open_counter(const perf_counter_e);
+static void read_counters(uint64_t*);
+static uint64_t now();
+static void print_row(FILE*, const char*, const double*, const bool*);
+static const char* reason(const int);
+
+//////////// implementations
+bool perf_init()
+{
+	if(perf.initialized) perf_free();
+	memset(&perf, 0, sizeof(perf));
+	perf.initialized = true;
+
+	bool any = false;
+	for(uint i = 0; i < PERF_COUNTERS; ++i) {
+		perf.fds[i] = open_counter(i);
+		perf.errors[i] = perf.fds[i] < 0 ? errno : 0;
+		any |= perf.fds[i] >= 0;
+	}
+	return any;
+}
+
+void perf_free()
+{
+	if(!perf.initialized) return;
+	for(uint i = 0; i < PERF_COUNTERS; ++i) {
+		if(perf.fds[i] >= 0) close(perf.fds[i]);
+		perf.fds[i] = -1;
+	}
+	perf.initialized = false;
+}
+
+bool perf_enabled()
+{
+	return perf.initialized;
+}
+
+void perf_begin(const perf_phase_e _phase)
+{
+	if(!perf.initialized) return;
+	perf.begun_at[_phase] = now();
+	// counters last, as close to the measured code as it gets
+	read_counters(perf.begun[_phase]);
+}
+
+void perf_end(const perf_phase_e _phase, const uint64_t _bytecodes)
+{
+	if(!perf.initialized) return;
+	uint64_t counts[PERF_COUNTERS];
+	read_counters(counts);
+	const uint64_t ended_at = now();
+
+	perf_totals_s* totals = &perf.totals[_phase];
+	for(uint i = 0; i < PERF_COUNTERS; ++i) {
+		// scaling can make a multiplexed counter go backwards a little
+		if(counts[i] > perf.begun[_phase][i]) totals->counts[i] += counts[i] - perf.begun[_phase][i];
+	}
+	totals->nanoseconds += ended_at - perf.begun_at[_phase];
+	totals->bytecodes += _bytecodes;
+	++totals->times;
+}
+
+perf_totals_s perf_totals(const perf_phase_e _phase)
+{
+	return perf.totals[_phase];
+}
+
+const char* perf_counter_name(const perf_counter_e _counter)
+{
+	switch(_counter) {
+		case PERF_CYCLES:			return "cycles";
+		case PERF_INSTRUCTIONS:		return "instructions";
+		case PERF_BRANCH_MISSES:	return "branch misses";
+		case PERF_L1D_MISSES:		return "L1d misses";
+		case PERF_ITLB_MISSES:		return "iTLB misses";
+		default:					return "undefined counter";
+	}
+}
+
+void print_perf_report(FILE* _file)
+{
+	if(!perf.initialized) return;
+
+	const perf_totals_s* compile = &perf.totals[PERF_COMPILE];
+	const perf_totals_s* run = &perf.totals[PERF_RUN];
+	fprintf(_file, "perf: %-20s %16s %16s\n", "", "compile", "run");
+	fprintf(_file, "      %-20s %16" PRIu64 " %16" PRIu64 "\n", "times", compile->times, run->times);
+	fprintf(_file, "      %-20s %16.3f %16.3f\n", "milliseconds", compile->nanoseconds / 1e6, run->nanoseconds / 1e6);
+	fprintf(_file, "      %-20s %16s %16" PRIu64 "\n", "bytecodes", "-", run->bytecodes);
+
+	bool counting = false;
+	for(uint i = 0; i < PERF_COUNTERS; ++i) counting |= perf.fds[i] >= 0;
+	if(!counting) {
+		// the same reason for all of them as a rule
+		if(run->bytecodes) fprintf(_file, "      %-20s %16s %16.3f\n", "ns per bytecode", "-", (double)run->nanoseconds / run->bytecodes);
+		fprintf(_file, "      no hardware counters: %s\n", reason(perf.errors[PERF_CYCLES]));
+		return;
+	}
+
+	for(uint i = 0; i < PERF_COUNTERS; ++i) {
+		const double values[PERF_PHASES] = {(double)compile->counts[i], (double)run->counts[i]};
+		const bool shown[PERF_PHASES] = {perf.fds[i] >= 0, perf.fds[i] >= 0};
+		print_row(_file, perf_counter_name(i), values, shown);
+	}
+
+	// per cycle and per bytecode are what dispatch changes are judged by
+	const bool counted = perf.fds[PERF_CYCLES] >= 0 && perf.fds[PERF_INSTRUCTIONS] >= 0;
+	double ipc[PERF_PHASES];
+	bool ipc_shown[PERF_PHASES];
+	for(uint phase = 0; phase < PERF_PHASES; ++phase) {
+		const perf_totals_s* totals = &perf.totals[phase];
+		ipc[phase] = totals->counts[PERF_CYCLES] ? (double)totals->counts[PERF_INSTRUCTIONS] / totals->counts[PERF_CYCLES] : 0;
+		ipc_shown[phase] = counted && totals->counts[PERF_CYCLES];
+	}
+	print_row(_file, "IPC", ipc, ipc_shown);
+
+	if(run->bytecodes) {
+		fprintf(_file, "      per bytecode\n");
+		for(uint i = 0; i < PERF_COUNTERS; ++i) {
+			const double values[PERF_PHASES] = {0, (double)run->counts[i] / run->bytecodes};
+			const bool shown[PERF_PHASES] = {false, perf.fds[i] >= 0};
+			print_row(_file, perf_counter_name(i), values, shown);
+		}
+		const double nanoseconds[PERF_PHASES] = {0, (double)run->nanoseconds / run->bytecodes};
+		const bool shown[PERF_PHASES] = {false, true};
+		print_row(_file, "nanoseconds", nanoseconds, shown);
+	}
+
+	for(uint i = 0; i < PERF_COUNTERS; ++i) {
+		if(perf.fds[i] >= 0) continue;
+		fprintf(_file, "      %s not counted: %s\n", perf_counter_name(i), reason(perf.errors[i]));
+	}
+}
+
+//////////// static implementations
+static int open_counter(const perf_counter_e _counter)
+{
+	struct perf_event_attr attributes;
+	memset(&attributes, 0, sizeof(attributes));
+	attributes.size = sizeof(attributes);
+	attributes.exclude_kernel = 1;
+	attributes.exclude_hv = 1;
+	attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	const uint64_t read_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	switch(_counter) {
+		case PERF_CYCLES:
+			attributes.type = PERF_TYPE_HARDWARE;
+			attributes.config = PERF_COUNT_HW_CPU_CYCLES;
+			break;
+		case PERF_INSTRUCTIONS:
+			attributes.type = PERF_TYPE_HARDWARE;
+			attributes.config = PERF_COUNT_HW_INSTRUCTIONS;
+			break;
+		case PERF_BRANCH_MISSES:
+			attributes.type = PERF_TYPE_HARDWARE;
+			attributes.config = PERF_COUNT_HW_BRANCH_MISSES;
+			break;
+		case PERF_L1D_MISSES:
+			attributes.type = PERF_TYPE_HW_CACHE;
+			attributes.config = PERF_COUNT_HW_CACHE_L1D | read_miss;
+			break;
+		case PERF_ITLB_MISSES:
+			attributes.type = PERF_TYPE_HW_CACHE;
+			attributes.config = PERF_COUNT_HW_CACHE_ITLB | read_miss;
+			break;
+		default:
+			errno = EINVAL;
+			return -1;
+	}
+
+	// this thread on any cpu, each counter on its own: in a group one
+	// unsupported event would take all the others down with it
+	return (int)syscall(SYS_perf_event_open, &attributes, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+static void read_counters(uint64_t* _counts)
+{
+	for(uint i = 0; i < PERF_COUNTERS; ++i) {
+		_counts[i] = 0;
+		if(perf.fds[i] < 0) continue;
+
+		uint64_t data[3];	// value, time enabled, time running
+		if(read(perf.fds[i], data, sizeof(data)) != sizeof(data)) continue;
+		if(data[2] == 0) continue;
+		_counts[i] = data[2] < data[1] ? (uint64_t)((double)data[0] * data[1] / data[2]) : data[0];
+	}
+}
+
+static uint64_t now()
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (uint64_t)time.tv_sec * 1000000000ULL + (uint64_t)time.tv_nsec;
+}
+
+static void print_row(FILE* _file, const char* _name, const double* _values, const bool* _shown)
+{
+	fprintf(_file, "      %-20s", _name);
+	for(uint phase = 0; phase < PERF_PHASES; ++phase) {
+		if(!_shown[phase]) {
+			fprintf(_file, " %16s", "-");
+		} else if(_values[phase] >= 1000) {
+			fprintf(_file, " %16.0f", _values[phase]);
+		} else {
+			fprintf(_file, " %16.3f", _values[phase]);
+		}
+	}
+	fprintf(_file, "\n");
+}
+
+static const char* reason(const int _error)
+{
+	switch(_error) {
+		case ENOENT:
+		case EOPNOTSUPP:	return "not supported by this cpu or hypervisor";
+		case EACCES:
+		case EPERM:			return "not permitted, see /proc/sys/kernel/perf_event_paranoid";
+		case ENOSYS:		return "perf_event_open() is not available";
+		default:			return strerror(_error);
+	}
+}
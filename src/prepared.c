@@ -0,0 +1,127 @@
+#include "../include/prepared.h"
+
+
+#include "../include/compiler.h"
+#include "../include/verifier.h"
+#include "../include/aot.h"
+#include "../include/memory.h"
+
+//////////// static types
+struct program_s {
+	chunk_s script;
+	uint stack_depth;	// proven by verify_program()
+	aot_program_s* native;	// NULL unless aot is enabled and the build worked
+	uint references;	// handles sharing the program, changed atomically
+};
+
+//////////// static functions
+static prepared_s* new_prepared(program_s*);
+static uint input_slots(const program_s*);
+
+//////////// implementations
+prepared_s* prepare(const char* _source)
+{
+	program_s* program = ALLOCATE(program_s, 1, MEMORY_HANDLES);
+	init_chunk(&program->script);
+	program->references = 0;
+
+	// the compiler serializes callers itself
+	bool compiled = compile_with_inputs(_source, &program->script);
+
+	if(!compiled) {
+		free_chunk(&program->script);
+		FREE(program_s, program, MEMORY_HANDLES);
+		return NULL;
+	}
+
+	verify_report_s report = verify_program(&program->script);
+	if(report.result != VERIFY_OK) {
+		fprintf(stderr, "[line %d] Verification error at %04d: %s\n",
+				verify_report_line(&report), report.offset, verify_result_message(report.result));
+		free_chunk(&program->script);
+		FREE(program_s, program, MEMORY_HANDLES);
+		return NULL;
+	}
+	program->stack_depth = report.max_depth;
+	program->native = get_aot_options().enabled ? aot_load(&program->script) : NULL;
+
+	return new_prepared(program);
+}
+
+prepared_s* clone_prepared(const prepared_s* _prepared)
+{
+	prepared_s* clone = new_prepared(_prepared->program);
+	const uint input_count = _prepared->program->script.inputs.size;
+	memcpy(clone->inputs, _prepared->inputs, sizeof(value_t) * input_count);
+	return clone;
+}
+
+void free_prepared(prepared_s* _prepared)
+{
+	program_s* program = _prepared->program;
+	free_vm(_prepared->vm);
+	FREE_ARRAY(value_t, _prepared->inputs, input_slots(program), MEMORY_INPUTS);
+	FREE(prepared_s, _prepared, MEMORY_HANDLES);
+
+	if(__atomic_sub_fetch(&program->references, 1, __ATOMIC_ACQ_REL) == 0) {
+		aot_free(program->native);
+		free_chunk(&program->script);
+		FREE(program_s, program, MEMORY_HANDLES);
+	}
+}
+
+int prepared_input(const prepared_s* _prepared, const char* _name)
+{
+	return find_input(&_prepared->program->script, _name, strlen(_name));
+}
+
+bool prepared_bind(prepared_s* _prepared, const char* _name, const double _value)
+{
+	int index = prepared_input(_prepared, _name);
+	if(index == -1) return false;
+
+	_prepared->inputs[index] = NUMBER_VAL(_value);
+	return true;
+}
+
+void prepared_bind_at(prepared_s* _prepared, const uint _index, const double _value)
+{
+	assert(_index < _prepared->program->script.inputs.size);
+	_prepared->inputs[_index] = NUMBER_VAL(_value);
+}
+
+interpret_result_e prepared_execute(prepared_s* _prepared, value_t* _result)
+{
+	if(_prepared->program->native) return aot_run(_prepared->program->native, _prepared->inputs, _result);
+
+	interpret_result_e result = prepared_start(_prepared);
+	if(result == INTERPRETER_OK) *_result = _prepared->vm->result;
+	return result;
+}
+
+interpret_result_e prepared_start(prepared_s* _prepared)
+{
+	program_s* program = _prepared->program;
+	return vm_run(_prepared->vm, &program->script, program->stack_depth, _prepared->inputs);
+}
+
+//////////// static implementations
+static prepared_s* new_prepared(program_s* _program)
+{
+	__atomic_add_fetch(&_program->references, 1, __ATOMIC_RELAXED);
+
+	prepared_s* prepared = ALLOCATE(prepared_s, 1, MEMORY_HANDLES);
+	prepared->program = _program;
+	prepared->vm = new_vm();
+
+	// zeroed memory leaves every input as nil, VAL_NIL is 0
+	prepared->inputs = (value_t*)allocate_zeroed(sizeof(value_t) * input_slots(_program), MEMORY_INPUTS);
+	return prepared;
+}
+
+// at least one, so a script without inputs still gets a block of its own
+static uint input_slots(const program_s* _program)
+{
+	const uint input_count = _program->script.inputs.size;
+	return input_count == 0 ? 1 : input_count;
+}
@@ -1,5 +1,11 @@
 #include "../include/scanner.h"
 
+#include "../include/memory.h"
+
+// tokens a window starts with, a power of two. It only grows for a lookahead
+// longer than that, see fill_token_window().
+#define TOKEN_WINDOW 512
+
 typedef struct {
 	const char* start;
 	const char* current;
@@ -23,6 +29,8 @@ static bool is_digit(const char);
 static bool is_alpha(const char);
 static token_type_e identifier_type();
 static token_type_e check_keyword(int, int, const char*, const token_type_e);
+static void append_token(token_stream_s*, const token_s);
+static void grow_window(token_stream_s*, const uint);
 
 void init_scanner(const char* _code)
 {
@@ -47,6 +55,8 @@ token_s scan_token()
 		case ')': return make_token(TOKEN_RIGHT_PAREN);
 		case '{': return make_token(TOKEN_LEFT_BRACE);
 		case '}': return make_token(TOKEN_RIGHT_BRACE);
+		case '[': return make_token(TOKEN_LEFT_BRACKET);
+		case ']': return make_token(TOKEN_RIGHT_BRACKET);
 		case ';': return make_token(TOKEN_SEMICOLON);
 		case ',': return make_token(TOKEN_COMMA);
 		case '.': return make_token(TOKEN_DOT);
@@ -69,6 +79,181 @@ token_s scan_token()
 	return make_error_token("unexpected character");
 }
 
+void scan_tokens(token_stream_s* _stream, const char* _code, const uint _line)
+{
+	// a token per four bytes covers ordinary code, so it rarely grows
+	const size_t length = strlen(_code);
+	const uint capacity = length / 4 + 16 < UINT32_MAX ? (uint)(length / 4 + 16) : UINT32_MAX;
+	_stream->source = _code;
+	_stream->count = 0;
+	_stream->capacity = capacity;
+	_stream->types	 = ALLOCATE(uint8_t, capacity, MEMORY_TOKENS);
+	_stream->offsets = ALLOCATE(uint32_t, capacity, MEMORY_TOKENS);
+	_stream->lengths = ALLOCATE(uint16_t, capacity, MEMORY_TOKENS);
+	_stream->mask = UINT32_MAX;
+	_stream->lines = NULL;
+	_stream->run_count = 0;
+	_stream->run_capacity = 32;
+	_stream->run_starts = ALLOCATE(uint32_t, _stream->run_capacity, MEMORY_TOKENS);
+	_stream->run_lines	= ALLOCATE(uint32_t, _stream->run_capacity, MEMORY_TOKENS);
+	_stream->message_count = 0;
+	_stream->messages = NULL;
+
+	init_scanner(_code);
+	scanner.line = _line;
+	// offsets are 32 bit
+	if(length > UINT32_MAX) {
+		append_token(_stream, make_error_token("source is too long"));
+		append_token(_stream, make_token(TOKEN_EOF));
+		return;
+	}
+
+	// the common case is inlined with everything in locals: a store through
+	// the uint8_t array may alias anything, so fields of *_stream would be
+	// read from memory again after every token
+	uint count = 0;
+	uint line = 0;
+	uint8_t* types = _stream->types;
+	uint32_t* offsets = _stream->offsets;
+	uint16_t* lengths = _stream->lengths;
+	while(true) {
+		token_s token = scan_token();
+		if(token.type != TOKEN_ERROR && token.length > UINT16_MAX) token = make_error_token("token is too long");
+
+		if(count == _stream->capacity || token.type == TOKEN_ERROR || token.line != line) {
+			_stream->count = count;
+			append_token(_stream, token);
+			types = _stream->types;
+			offsets = _stream->offsets;
+			lengths = _stream->lengths;
+			line = token.line;
+		} else {
+			offsets[count] = (uint32_t)(token.start - _code);
+			lengths[count] = (uint16_t)token.length;
+			types[count] = (uint8_t)token.type;
+		}
+		++count;
+		if(token.type == TOKEN_EOF) break;
+	}
+	_stream->count = count;
+}
+
+void open_token_window(token_stream_s* _stream, const char* _code, const uint _line)
+{
+	_stream->source = _code;
+	_stream->count = 0;
+	_stream->capacity = TOKEN_WINDOW;
+	_stream->mask = TOKEN_WINDOW - 1;
+	_stream->types	 = ALLOCATE(uint8_t, TOKEN_WINDOW, MEMORY_TOKENS);
+	_stream->offsets = ALLOCATE(uint32_t, TOKEN_WINDOW, MEMORY_TOKENS);
+	_stream->lengths = ALLOCATE(uint16_t, TOKEN_WINDOW, MEMORY_TOKENS);
+	_stream->lines	 = ALLOCATE(uint32_t, TOKEN_WINDOW, MEMORY_TOKENS);
+	_stream->run_count = _stream->run_capacity = 0;
+	_stream->run_starts = _stream->run_lines = NULL;
+	_stream->message_count = 0;
+	_stream->messages = NULL;
+
+	init_scanner(_code);
+	scanner.line = _line;
+	fill_token_window(_stream, 0, 0);
+}
+
+void fill_token_window(token_stream_s* _stream, const uint _index, const uint _keep)
+{
+	while(_index - _keep >= _stream->capacity) grow_window(_stream, _keep);
+
+	// every free slot is filled at once, the parser asks for them in order.
+	// The arrays are in locals for the same reason as in scan_tokens().
+	const uint end = _keep + _stream->capacity;
+	const uint mask = _stream->mask;
+	const char* source = _stream->source;
+	uint8_t* types = _stream->types;
+	uint32_t* offsets = _stream->offsets;
+	uint16_t* lengths = _stream->lengths;
+	uint32_t* lines = _stream->lines;
+	uint count = _stream->count;
+	while(count < end) {
+		token_s token = scan_token();
+		if(token.type != TOKEN_ERROR && token.length > UINT16_MAX) token = make_error_token("token is too long");
+		if(token.type != TOKEN_ERROR && (size_t)(token.start - source) > UINT32_MAX) {
+			// offsets are 32 bit, the rest is never scanned
+			token = make_error_token("source is too long");
+			scanner.current += strlen(scanner.current);
+		}
+
+		const uint slot = count & mask;
+		types[slot] = (uint8_t)token.type;
+		lines[slot] = token.line;
+		if(token.type == TOKEN_ERROR) {
+			_stream->messages = GROW_ARRAY(const char*, _stream->messages, _stream->message_count, _stream->message_count + 1, MEMORY_TOKENS);
+			_stream->messages[_stream->message_count] = token.start;
+			offsets[slot] = _stream->message_count++;
+			lengths[slot] = 0;
+		} else {
+			offsets[slot] = (uint32_t)(token.start - source);
+			lengths[slot] = (uint16_t)token.length;
+		}
+		++count;
+		if(token.type == TOKEN_EOF && count > _index) break;
+	}
+	_stream->count = count;
+}
+
+void free_token_stream(token_stream_s* _stream)
+{
+	FREE_ARRAY(uint8_t, _stream->types, _stream->capacity, MEMORY_TOKENS);
+	FREE_ARRAY(uint32_t, _stream->offsets, _stream->capacity, MEMORY_TOKENS);
+	FREE_ARRAY(uint16_t, _stream->lengths, _stream->capacity, MEMORY_TOKENS);
+	FREE_ARRAY(uint32_t, _stream->lines, _stream->capacity, MEMORY_TOKENS);
+	FREE_ARRAY(uint32_t, _stream->run_starts, _stream->run_capacity, MEMORY_TOKENS);
+	FREE_ARRAY(uint32_t, _stream->run_lines, _stream->run_capacity, MEMORY_TOKENS);
+	FREE_ARRAY(const char*, _stream->messages, _stream->message_count, MEMORY_TOKENS);
+	_stream->count = _stream->capacity = 0;
+	_stream->run_count = _stream->run_capacity = 0;
+	_stream->message_count = 0;
+}
+
+token_s stream_token(const token_stream_s* _stream, const uint _index)
+{
+	token_s ret_val;
+	uint run = _stream->run_count;	// no cursor, search
+	const uint slot = _index & _stream->mask;
+
+	ret_val.type = (token_type_e)_stream->types[slot];
+	if(ret_val.type == TOKEN_ERROR) {
+		ret_val.start  = _stream->messages[_stream->offsets[slot]];
+		ret_val.length = (uint)strlen(ret_val.start);
+	} else {
+		ret_val.start  = _stream->source + _stream->offsets[slot];
+		ret_val.length = _stream->lengths[slot];
+	}
+	ret_val.line = stream_line(_stream, &run, _index);
+
+	return ret_val;
+}
+
+uint stream_line(const token_stream_s* _stream, uint* _run, const uint _index)
+{
+	if(_stream->lines) return _stream->lines[_index & _stream->mask];
+
+	uint run = *_run;
+	if(run >= _stream->run_count || _stream->run_starts[run] > _index) {
+		// not walking forward, binary search for the last run starting at or before it
+		uint low = 0;
+		uint high = _stream->run_count;
+		while(high - low > 1) {
+			const uint middle = low + (high - low) / 2;
+			if(_stream->run_starts[middle] <= _index) low = middle;
+			else high = middle;
+		}
+		run = low;
+	}
+	while(run + 1 < _stream->run_count && _stream->run_starts[run + 1] <= _index) ++run;
+
+	*_run = run;
+	return _stream->run_lines[run];
+}
+
 static bool reached_end()
 {
 	return *scanner.current == '\0';
@@ -105,8 +290,8 @@ static inline char advance()
 
 static bool match(const char _char)
 {
-	if(reached_end) return false;
-	if(scanner.current[1] != _char) return false;
+	if(reached_end()) return false;
+	if(*scanner.current != _char) return false;
 
 	++scanner.current;
 	return true;
@@ -208,21 +393,23 @@ static token_type_e identifier_type()
 		case 'v': return check_keyword(1, 2, "ar", TOKEN_VAR);
 		case 'w': return check_keyword(1, 4, "hile", TOKEN_WHILE);
 		case 'f': {
-			if(scanner.start - scanner.current > 0) {
+			if(scanner.current - scanner.start > 1) {
 				switch(scanner.start[1]) {
 					case 'a': return check_keyword(2, 3, "lse", TOKEN_FALSE);
 					case 'o': return check_keyword(2, 1, "r", TOKEN_FOR);
 					case 'u': return check_keyword(2, 1, "n", TOKEN_FUN);
 				}
 			}
+			break;
 		}
 		case 't': {
-			if(scanner.start - scanner.current > 0) {
+			if(scanner.current - scanner.start > 1) {
 				switch(scanner.start[1]) {
 					case 'h': return check_keyword(2, 2, "is", TOKEN_THIS);
 					case 'r': return check_keyword(2, 2, "ue", TOKEN_TRUE);
 				}
 			}
+			break;
 		}
 	}
 
@@ -239,3 +426,65 @@ static token_type_e check_keyword(int _start, int _len, const char* _rest, const
 	}
 }
 
+static void append_token(token_stream_s* _stream, const token_s _token)
+{
+	if(_stream->count == _stream->capacity) {
+		const uint capacity = _stream->capacity * 2;
+		_stream->types	 = GROW_ARRAY(uint8_t, _stream->types, _stream->capacity, capacity, MEMORY_TOKENS);
+		_stream->offsets = GROW_ARRAY(uint32_t, _stream->offsets, _stream->capacity, capacity, MEMORY_TOKENS);
+		_stream->lengths = GROW_ARRAY(uint16_t, _stream->lengths, _stream->capacity, capacity, MEMORY_TOKENS);
+		_stream->capacity = capacity;
+	}
+
+	const uint index = _stream->count++;
+	_stream->types[index] = (uint8_t)_token.type;
+	if(_token.type == TOKEN_ERROR) {
+		_stream->messages = GROW_ARRAY(const char*, _stream->messages, _stream->message_count, _stream->message_count + 1, MEMORY_TOKENS);
+		_stream->messages[_stream->message_count] = _token.start;
+		_stream->offsets[index] = _stream->message_count++;
+		_stream->lengths[index] = 0;
+	} else {
+		_stream->offsets[index] = (uint32_t)(_token.start - _stream->source);
+		_stream->lengths[index] = (uint16_t)_token.length;
+	}
+
+	if(_stream->run_count > 0 && _stream->run_lines[_stream->run_count - 1] == _token.line) return;
+	if(_stream->run_count == _stream->run_capacity) {
+		const uint capacity = _stream->run_capacity * 2;
+		_stream->run_starts = GROW_ARRAY(uint32_t, _stream->run_starts, _stream->run_capacity, capacity, MEMORY_TOKENS);
+		_stream->run_lines	= GROW_ARRAY(uint32_t, _stream->run_lines, _stream->run_capacity, capacity, MEMORY_TOKENS);
+		_stream->run_capacity = capacity;
+	}
+	_stream->run_starts[_stream->run_count] = index;
+	_stream->run_lines[_stream->run_count++] = _token.line;
+}
+
+// the window doubles, every token from _keep on moves to its slot under the
+// new mask
+static void grow_window(token_stream_s* _stream, const uint _keep)
+{
+	const uint capacity = _stream->capacity * 2;
+	const uint mask = capacity - 1;
+	uint8_t* types	  = ALLOCATE(uint8_t, capacity, MEMORY_TOKENS);
+	uint32_t* offsets = ALLOCATE(uint32_t, capacity, MEMORY_TOKENS);
+	uint16_t* lengths = ALLOCATE(uint16_t, capacity, MEMORY_TOKENS);
+	uint32_t* lines	  = ALLOCATE(uint32_t, capacity, MEMORY_TOKENS);
+	for(uint i = _keep; i < _stream->count; ++i) {
+		const uint from = i & _stream->mask;
+		types[i & mask]	  = _stream->types[from];
+		offsets[i & mask] = _stream->offsets[from];
+		lengths[i & mask] = _stream->lengths[from];
+		lines[i & mask]	  = _stream->lines[from];
+	}
+
+	FREE_ARRAY(uint8_t, _stream->types, _stream->capacity, MEMORY_TOKENS);
+	FREE_ARRAY(uint32_t, _stream->offsets, _stream->capacity, MEMORY_TOKENS);
+	FREE_ARRAY(uint16_t, _stream->lengths, _stream->capacity, MEMORY_TOKENS);
+	FREE_ARRAY(uint32_t, _stream->lines, _stream->capacity, MEMORY_TOKENS);
+	_stream->types	 = types;
+	_stream->offsets = offsets;
+	_stream->lengths = lengths;
+	_stream->lines	 = lines;
+	_stream->capacity = capacity;
+	_stream->mask = mask;
+}
@@ -0,0 +1,466 @@
+#include "../include/snapshot.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../include/chunk.h"
+#include "../include/cache.h"
+#include "../include/native.h"
+#include "../include/verifier.h"
+#include "../include/vm.h"
+#include "../include/memory.h"
+
+//////////// static types
+// the payload follows right behind it
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;	// SNAPSHOT_BYTE_ORDER as the writer stored it
+	uint64_t payload;		// bytes after the header
+	uint64_t checksum;		// FNV-1a of the payload
+}image_header_s;
+
+typedef struct {
+	uint8_t* data;
+	size_t size;
+	size_t capacity;
+}buffer_s;
+
+// reads past the end return zeros and set truncated, so a record is
+// parsed whole and checked once
+typedef struct {
+	const uint8_t* at;
+	const uint8_t* end;
+	bool truncated;
+}reader_s;
+
+typedef struct {
+	const char* source;		// in the mapping
+	uint optimization_level;
+	bool lazy;
+	chunk_s chunk;
+	uint stack_depth;
+}program_s;
+
+//////////// static variables
+static const char image_magic[8] = {'L', 'O', 'X', 'I', 'M', 'A', 'G', 'E'};
+#define SNAPSHOT_BYTE_ORDER 0x01020304u
+
+//////////// static functions
+static void put(buffer_s*, const void*, const size_t);
+static void put_u8(buffer_s*, const uint8_t);
+static void put_u32(buffer_s*, const uint32_t);
+static void put_u64(buffer_s*, const uint64_t);
+static void put_string(buffer_s*, const char*);
+static void put_chunk(buffer_s*, const chunk_s*);
+
+static const uint8_t* take(reader_s*, const size_t);
+static uint8_t get_u8(reader_s*);
+static uint32_t get_u32(reader_s*);
+static uint64_t get_u64(reader_s*);
+static const char* get_string(reader_s*, uint* _length);
+static bool get_chunk(reader_s*, chunk_s*, const bool _script);
+static snapshot_result_e read_image(const uint8_t*, const size_t, uint*);
+
+static uint64_t checksum(const uint8_t*, const size_t);
+
+//////////// implementations
+snapshot_result_e save_snapshot(const char* _path)
+{
+	const uint capacity = cache_stats().entries;
+	cache_entry_s** entries = ALLOCATE(cache_entry_s*, capacity + 1, MEMORY_SCRATCH);
+	const uint count = cache_collect(entries, capacity);
+
+	buffer_s payload = {.data = NULL, .size = 0, .capacity = 0};
+	put_u32(&payload, native_count);
+	for(uint i = 0; i < native_count; ++i) put_string(&payload, native_name(i));
+
+	put_u32(&payload, count);
+	for(uint i = 0; i < count; ++i) {
+		const cache_entry_s* entry = entries[i];
+		put_u32(&payload, entry->optimization_level);
+		put_u8(&payload, entry->lazy);
+		put_u64(&payload, entry->length + 1);
+		put(&payload, entry->source, entry->length + 1);
+		put_chunk(&payload, &entry->chunk);
+		cache_release(entries[i]);
+	}
+	FREE_ARRAY(cache_entry_s*, entries, capacity + 1, MEMORY_SCRATCH);
+
+	image_header_s header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, image_magic, sizeof(header.magic));
+	header.version = SNAPSHOT_VERSION;
+	header.byte_order = SNAPSHOT_BYTE_ORDER;
+	header.payload = payload.size;
+	header.checksum = checksum(payload.data, payload.size);
+
+	// written next to it and renamed, a reader never maps half an image
+	const size_t length = strlen(_path);
+	char* partial = ALLOCATE(char, length + 9, MEMORY_SCRATCH);
+	snprintf(partial, length + 9, "%s.partial", _path);
+
+	snapshot_result_e result = SNAPSHOT_OK;
+	FILE* file = fopen(partial, "wb");
+	if(!file) {
+		result = SNAPSHOT_IO_ERROR;
+	} else {
+		bool written = fwrite(&header, sizeof(header), 1, file) == 1
+					&& (payload.size == 0 || fwrite(payload.data, payload.size, 1, file) == 1);
+		written &= fclose(file) == 0;
+		if(!written || rename(partial, _path) != 0) {
+			const int error = errno;
+			remove(partial);
+			errno = error;
+			result = SNAPSHOT_IO_ERROR;
+		}
+	}
+
+	FREE_ARRAY(char, partial, length + 9, MEMORY_SCRATCH);
+	FREE_ARRAY(uint8_t, payload.data, payload.capacity, MEMORY_SCRATCH);
+	return result;
+}
+
+snapshot_result_e load_snapshot(const char* _path, uint* _programs)
+{
+	if(_programs) *_programs = 0;
+
+	const int file = open(_path, O_RDONLY | O_CLOEXEC);
+	if(file < 0) return SNAPSHOT_IO_ERROR;
+	struct stat status;
+	if(fstat(file, &status) != 0) {
+		close(file);
+		return SNAPSHOT_IO_ERROR;
+	}
+	if((size_t)status.st_size < sizeof(image_header_s)) {
+		close(file);
+		return SNAPSHOT_NOT_AN_IMAGE;
+	}
+
+	const size_t size = (size_t)status.st_size;
+	void* image = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+	if(image == MAP_FAILED) return SNAPSHOT_IO_ERROR;
+	madvise(image, size, MADV_SEQUENTIAL);
+
+	// everything is copied out, the mapping goes when it is read
+	snapshot_result_e result = read_image(image, size, _programs);
+	munmap(image, size);
+	return result;
+}
+
+const char* snapshot_result_message(const snapshot_result_e _result)
+{
+	switch(_result) {
+		case SNAPSHOT_OK:				return "ok";
+		case SNAPSHOT_IO_ERROR:			return strerror(errno);
+		case SNAPSHOT_NOT_AN_IMAGE:		return "not an image";
+		case SNAPSHOT_BAD_VERSION:		return "image of another version or byte order";
+		case SNAPSHOT_BAD_CHECKSUM:		return "image is corrupt, its checksum doesn't match";
+		case SNAPSHOT_TRUNCATED:		return "image is truncated";
+		case SNAPSHOT_NATIVES_DIFFER:	return "image was made with other natives";
+		case SNAPSHOT_UNVERIFIABLE:		return "image holds a program that fails verification or takes inputs";
+		default:						return "undefined result";
+	}
+}
+
+//////////// static implementations
+static void put(buffer_s* _buffer, const void* _data, const size_t _size)
+{
+	if(_buffer->size + _size > _buffer->capacity) {
+		size_t capacity = _buffer->capacity == 0 ? 4096 : _buffer->capacity * 2;
+		while(capacity < _buffer->size + _size) capacity *= 2;
+		_buffer->data = GROW_ARRAY(uint8_t, _buffer->data, _buffer->capacity, capacity, MEMORY_SCRATCH);
+		_buffer->capacity = capacity;
+	}
+	memcpy(_buffer->data + _buffer->size, _data, _size);
+	_buffer->size += _size;
+}
+
+static void put_u8(buffer_s* _buffer, const uint8_t _value)
+{
+	put(_buffer, &_value, sizeof(_value));
+}
+
+static void put_u32(buffer_s* _buffer, const uint32_t _value)
+{
+	put(_buffer, &_value, sizeof(_value));
+}
+
+static void put_u64(buffer_s* _buffer, const uint64_t _value)
+{
+	put(_buffer, &_value, sizeof(_value));
+}
+
+static void put_string(buffer_s* _buffer, const char* _string)
+{
+	const uint32_t length = (uint32_t)strlen(_string);
+	put_u32(_buffer, length);
+	put(_buffer, _string, length);
+}
+
+// functions are only written for the script, they own none themselves
+static void put_chunk(buffer_s* _buffer, const chunk_s* _chunk)
+{
+	put_u32(_buffer, _chunk->size);
+	put(_buffer, _chunk->data, _chunk->size);
+	for(uint i = 0; i < _chunk->size; ++i) put_u32(_buffer, _chunk->lines[i]);
+
+	put_u32(_buffer, _chunk->literals.size);
+	for(uint i = 0; i < _chunk->literals.size; ++i) {
+		const value_t value = _chunk->literals.data[i];
+		put_u8(_buffer, (uint8_t)value.type);
+		switch(value.type) {
+			case VAL_BOOL:		put_u64(_buffer, AS_BOOL(value)); break;
+			case VAL_INT:		put_u64(_buffer, (uint64_t)AS_INT(value)); break;
+			case VAL_NUMBER: {
+				uint64_t bits;
+				memcpy(&bits, &value.as.number, sizeof(bits));
+				put_u64(_buffer, bits);
+				break;
+			}
+			default:			put_u64(_buffer, 0); break;
+		}
+	}
+
+	put_u32(_buffer, _chunk->inputs.size);
+	for(uint i = 0; i < _chunk->inputs.size; ++i) put_string(_buffer, _chunk->inputs.data[i]);
+
+	put_u32(_buffer, _chunk->functions.size);
+	for(uint i = 0; i < _chunk->functions.size; ++i) {
+		function_s* function = _chunk->functions.data[i];
+		put_string(_buffer, function->name);
+		put_u8(_buffer, function->arity);
+		put_u8(_buffer, function->defined);
+
+		// a lazy body that ran is kept compiled, one that didn't as its text
+		const chunk_s* body = function_body(function);
+		put_u8(_buffer, body == NULL);
+		if(body) {
+			put_chunk(_buffer, body);
+		} else {
+			put_string(_buffer, function->lazy->source);
+			put_u32(_buffer, function->lazy->line);
+			put_u32(_buffer, function->lazy->optimization_level);
+		}
+	}
+}
+
+static const uint8_t* take(reader_s* _reader, const size_t _size)
+{
+	if(_reader->truncated || (size_t)(_reader->end - _reader->at) < _size) {
+		_reader->truncated = true;
+		return NULL;
+	}
+	const uint8_t* data = _reader->at;
+	_reader->at += _size;
+	return data;
+}
+
+static uint8_t get_u8(reader_s* _reader)
+{
+	const uint8_t* data = take(_reader, sizeof(uint8_t));
+	return data ? *data : 0;
+}
+
+static uint32_t get_u32(reader_s* _reader)
+{
+	uint32_t value = 0;
+	const uint8_t* data = take(_reader, sizeof(value));
+	if(data) memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+static uint64_t get_u64(reader_s* _reader)
+{
+	uint64_t value = 0;
+	const uint8_t* data = take(_reader, sizeof(value));
+	if(data) memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+// not terminated, it points into the image
+static const char* get_string(reader_s* _reader, uint* _length)
+{
+	*_length = get_u32(_reader);
+	const char* string = (const char*)take(_reader, *_length);
+	if(!string) *_length = 0;
+	return string ? string : "";
+}
+
+// false if the image ends inside the chunk, which is left initialized
+// either way so free_chunk() can take it
+static bool get_chunk(reader_s* _reader, chunk_s* _chunk, const bool _script)
+{
+	init_chunk(_chunk);
+
+	// counts are checked against what is left before anything is sized
+	// by them, a crafted image can't make it allocate more than its size
+	const uint size = get_u32(_reader);
+	const uint8_t* code = take(_reader, size);
+	const uint8_t* lines = take(_reader, (size_t)size * sizeof(uint32_t));
+	if(!code || !lines) return false;
+	if(size >= _chunk->capacity) {
+		const uint capacity = size + 1;
+		_chunk->data = GROW_ARRAY(uint8_t, _chunk->data, _chunk->capacity, capacity, MEMORY_BYTECODE);
+		_chunk->lines = GROW_ARRAY(uint, _chunk->lines, _chunk->capacity, capacity, MEMORY_LINES);
+		_chunk->capacity = capacity;
+	}
+	memcpy(_chunk->data, code, size);
+	for(uint i = 0; i < size; ++i) {
+		uint32_t line;
+		memcpy(&line, lines + i * sizeof(uint32_t), sizeof(line));
+		_chunk->lines[i] = line;
+	}
+	_chunk->size = size;
+
+	const uint literals = get_u32(_reader);
+	if((size_t)(_reader->end - _reader->at) < (size_t)literals * 9) {
+		_reader->truncated = true;
+		return false;
+	}
+	for(uint i = 0; i < literals; ++i) {
+		const uint8_t type = get_u8(_reader);
+		const uint64_t bits = get_u64(_reader);
+		value_t value = NIL_VAL;
+		switch(type) {
+			case VAL_NIL:		break;
+			case VAL_BOOL:		value = BOOL_VAL(bits != 0); break;
+			case VAL_INT:		value = INT_VAL((int64_t)bits); break;
+			case VAL_NUMBER: {
+				double number;
+				memcpy(&number, &bits, sizeof(number));
+				value = NUMBER_VAL(number);
+				break;
+			}
+			default:			return false;
+		}
+		append_literal(_chunk, value);
+	}
+
+	const uint inputs = get_u32(_reader);
+	for(uint i = 0; i < inputs && !_reader->truncated; ++i) {
+		uint length;
+		const char* name = get_string(_reader, &length);
+		append_input(_chunk, name, length);
+	}
+
+	const uint functions = _script ? get_u32(_reader) : 0;
+	if(!_script && get_u32(_reader) != 0) return false;
+	for(uint i = 0; i < functions && !_reader->truncated; ++i) {
+		uint length;
+		const char* name = get_string(_reader, &length);
+		function_s* function = new_function(name, length);
+		append_function(_chunk, function);
+		// new_function() made it an empty chunk, the image has the real one
+		free_chunk(&function->chunk);
+		function->arity = get_u8(_reader);
+		function->defined = get_u8(_reader) != 0;
+		if(get_u8(_reader) == 0) {
+			if(!get_chunk(_reader, &function->chunk, false)) return false;
+			continue;
+		}
+
+		init_stub_chunk(&function->chunk, OP_LAZY, (uint8_t)i, 0);
+		const char* source = get_string(_reader, &length);
+		lazy_body_s* lazy = ALLOCATE(lazy_body_s, 1, MEMORY_FUNCTIONS);
+		lazy->length = length;
+		lazy->source = ALLOCATE(char, length + 1, MEMORY_FUNCTIONS);
+		memcpy(lazy->source, source, length);
+		lazy->source[length] = '\0';
+		lazy->line = get_u32(_reader);
+		lazy->optimization_level = get_u32(_reader);
+		lazy->body = NULL;
+		lazy->failed = false;
+		function->lazy = lazy;
+		function->chunk.lines[0] = function->chunk.lines[1] = lazy->line;
+	}
+	return !_reader->truncated;
+}
+
+static snapshot_result_e read_image(const uint8_t* _image, const size_t _size, uint* _programs)
+{
+	image_header_s header;
+	memcpy(&header, _image, sizeof(header));
+	if(memcmp(header.magic, image_magic, sizeof(header.magic)) != 0) return SNAPSHOT_NOT_AN_IMAGE;
+	if(header.version != SNAPSHOT_VERSION || header.byte_order != SNAPSHOT_BYTE_ORDER) return SNAPSHOT_BAD_VERSION;
+	if(header.payload != _size - sizeof(header)) return SNAPSHOT_TRUNCATED;
+
+	const uint8_t* payload = _image + sizeof(header);
+	if(checksum(payload, header.payload) != header.checksum) return SNAPSHOT_BAD_CHECKSUM;
+	reader_s reader = {.at = payload, .end = payload + header.payload, .truncated = false};
+
+	// scripts were compiled against these indices
+	const uint natives = get_u32(&reader);
+	if(natives > native_count) return SNAPSHOT_NATIVES_DIFFER;
+	for(uint i = 0; i < natives; ++i) {
+		uint length;
+		const char* name = get_string(&reader, &length);
+		if(reader.truncated) return SNAPSHOT_TRUNCATED;
+		if(strlen(native_name(i)) != length || memcmp(native_name(i), name, length) != 0) return SNAPSHOT_NATIVES_DIFFER;
+	}
+
+	// a program takes more than a byte, which bounds the count
+	const uint count = get_u32(&reader);
+	if(reader.truncated || count > (size_t)(reader.end - reader.at)) return SNAPSHOT_TRUNCATED;
+
+	// all of them are read and verified before the first goes into the
+	// cache, an image is taken whole or not at all
+	program_s* programs = ALLOCATE(program_s, count + 1, MEMORY_SCRATCH);
+	snapshot_result_e result = SNAPSHOT_OK;
+	uint read = 0;
+	for(; read < count; ++read) {
+		program_s* program = &programs[read];
+		program->optimization_level = get_u32(&reader);
+		program->lazy = get_u8(&reader);
+		const uint64_t length = get_u64(&reader);
+		program->source = (const char*)take(&reader, length);
+		const bool complete = get_chunk(&reader, &program->chunk, true);
+		if(!complete || !program->source) {
+			++read;
+			result = SNAPSHOT_TRUNCATED;
+			break;
+		}
+		// stored with its terminator, the cache takes it from the mapping
+		if(length == 0 || memchr(program->source, '\0', length) != program->source + length - 1) {
+			++read;
+			result = SNAPSHOT_NOT_AN_IMAGE;
+			break;
+		}
+
+		// vm_interpret() runs cached scripts without inputs, only a bad
+		// image has one that declares them, and the verifier would pass
+		// its OP_GET_INPUTs
+		verify_report_s report = verify_program(&program->chunk);
+		program->stack_depth = report.max_depth;
+		if(report.result != VERIFY_OK || program->chunk.inputs.size != 0) {
+			++read;
+			result = SNAPSHOT_UNVERIFIABLE;
+			break;
+		}
+	}
+
+	for(uint i = 0; i < read; ++i) {
+		program_s* program = &programs[i];
+		if(result == SNAPSHOT_OK) {
+			cache_release(cache_insert(program->source, program->optimization_level, program->lazy, &program->chunk, program->stack_depth));
+		} else {
+			free_chunk(&program->chunk);
+		}
+	}
+	if(result == SNAPSHOT_OK && _programs) *_programs = read;
+	FREE_ARRAY(program_s, programs, count + 1, MEMORY_SCRATCH);
+	return result;
+}
+
+static uint64_t checksum(const uint8_t* _data, const size_t _size)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	for(size_t i = 0; i < _size; ++i) {
+		hash ^= _data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
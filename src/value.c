@@ -0,0 +1,98 @@
+#include "../include/value.h"
+#include "../include/array.h"
+
+void print_value(const value_t _value)
+{
+	switch(_value.type) {
+		case VAL_NIL:	 printf("nil"); break;
+		case VAL_BOOL:	 printf(AS_BOOL(_value) ? "true" : "false"); break;
+		case VAL_NUMBER: printf("%g", AS_NUMBER(_value)); break;
+		case VAL_INT:	 printf("%" PRId64, AS_INT(_value)); break;
+		case VAL_ARRAY:	 print_array(AS_ARRAY(_value)); break;
+	}
+}
+
+bool values_equal(const value_t _a, const value_t _b)
+{
+	if(IS_NUMERIC(_a) && IS_NUMERIC(_b) && _a.type != _b.type) return compare_values(_a, _b) == 0;
+	if(_a.type != _b.type) return false;
+	switch(_a.type) {
+		case VAL_NIL:	 return true;
+		case VAL_BOOL:	 return AS_BOOL(_a) == AS_BOOL(_b);
+		case VAL_NUMBER: return AS_NUMBER(_a) == AS_NUMBER(_b);
+		case VAL_INT:	 return AS_INT(_a) == AS_INT(_b);
+		case VAL_ARRAY:	 return arrays_equal(AS_ARRAY(_a), AS_ARRAY(_b));
+	}
+	return false;
+}
+
+bool is_falsey(const value_t _value)
+{
+	return IS_NIL(_value) || (IS_BOOL(_value) && !AS_BOOL(_value));
+}
+
+value_t add_values(const value_t _a, const value_t _b)
+{
+	int64_t result;
+	if(IS_INT(_a) && IS_INT(_b) && !__builtin_add_overflow(AS_INT(_a), AS_INT(_b), &result)) {
+		return INT_VAL(result);
+	}
+	return NUMBER_VAL(AS_FLOAT(_a) + AS_FLOAT(_b));
+}
+
+value_t subtract_values(const value_t _a, const value_t _b)
+{
+	int64_t result;
+	if(IS_INT(_a) && IS_INT(_b) && !__builtin_sub_overflow(AS_INT(_a), AS_INT(_b), &result)) {
+		return INT_VAL(result);
+	}
+	return NUMBER_VAL(AS_FLOAT(_a) - AS_FLOAT(_b));
+}
+
+value_t multiply_values(const value_t _a, const value_t _b)
+{
+	int64_t result;
+	if(IS_INT(_a) && IS_INT(_b) && !__builtin_mul_overflow(AS_INT(_a), AS_INT(_b), &result)) {
+		return INT_VAL(result);
+	}
+	return NUMBER_VAL(AS_FLOAT(_a) * AS_FLOAT(_b));
+}
+
+value_t divide_values(const value_t _a, const value_t _b)
+{
+	return NUMBER_VAL(AS_FLOAT(_a) / AS_FLOAT(_b));
+}
+
+value_t negate_value(const value_t _value)
+{
+	if(IS_INT(_value) && AS_INT(_value) != INT64_MIN) return INT_VAL(-AS_INT(_value));
+	return NUMBER_VAL(-AS_FLOAT(_value));
+}
+
+// An int and a double are compared exactly, not by rounding the int
+int compare_values(const value_t _a, const value_t _b)
+{
+	if(IS_INT(_a) && IS_INT(_b)) return (AS_INT(_a) > AS_INT(_b)) - (AS_INT(_a) < AS_INT(_b));
+	if(IS_INT(_b)) {
+		const int swapped = compare_values(_b, _a);
+		return swapped == 2 ? 2 : -swapped;
+	}
+
+	const double b = AS_NUMBER(_b);
+	if(b != b) return 2;
+	if(IS_NUMBER(_a)) {
+		const double a = AS_NUMBER(_a);
+		if(a != a) return 2;
+		return (a > b) - (a < b);
+	}
+
+	// int against double. Every int64 lies within (-2^63 - 1, 2^63), so
+	// outside of that the double decides, inside it truncating is exact
+	const int64_t a = AS_INT(_a);
+	if(b >= 9223372036854775808.0) return -1;
+	if(b < -9223372036854775808.0) return 1;
+	const int64_t whole = (int64_t)b;
+	if(a != whole) return (a > whole) - (a < whole);
+	const double fraction = b - (double)whole;
+	return (fraction > 0) ? -1 : (fraction < 0) ? 1 : 0;
+}
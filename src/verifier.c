@@ -0,0 +1,349 @@
+#include "../include/verifier.h"
+#include "../include/native.h"
+#include "../include/memory.h"
+
+//////////// static types
+typedef enum {
+	FLOW_NEXT = 0,		// falls through to the next instruction
+	FLOW_JUMP,			// always jumps forward
+	FLOW_LOOP,			// always jumps backward
+	FLOW_BRANCH,		// jumps forward or falls through
+	FLOW_END,			// leaves the chunk
+}flow_e;
+
+typedef struct {
+	bool valid;
+	uint8_t operands;	// operand bytes following the opcode
+	uint8_t pops;
+	uint8_t pushes;
+	flow_e flow;
+	uint8_t jump_pushes; // pushes when a branch is taken, if different
+}opcode_info_s;
+
+//////////// static variables
+static const opcode_info_s opcode_info[] = {
+	[OP_UNDEFINED] = {false, 0, 0, 0, FLOW_NEXT, 0},
+	[OP_RETURN]    = {true,  0, 1, 0, FLOW_END,  0},
+	[OP_ADD]       = {true,  0, 2, 1, FLOW_NEXT, 0},
+	[OP_SUBTRACT]  = {true,  0, 2, 1, FLOW_NEXT, 0},
+	[OP_MULTIPLY]  = {true,  0, 2, 1, FLOW_NEXT, 0},
+	[OP_DIVIDE]    = {true,  0, 2, 1, FLOW_NEXT, 0},
+	[OP_NEGATION]  = {true,  0, 1, 1, FLOW_NEXT, 0},
+	[OP_CONSTANT]  = {true,  1, 0, 1, FLOW_NEXT, 0},
+	[OP_NIL]       = {true,  0, 0, 1, FLOW_NEXT, 0},
+	[OP_TRUE]      = {true,  0, 0, 1, FLOW_NEXT, 0},
+	[OP_FALSE]     = {true,  0, 0, 1, FLOW_NEXT, 0},
+
+	[OP_ADD_NUM_NUM]      = {true, 0, 2, 1, FLOW_NEXT, 0},
+	[OP_SUBTRACT_NUM_NUM] = {true, 0, 2, 1, FLOW_NEXT, 0},
+	[OP_MULTIPLY_NUM_NUM] = {true, 0, 2, 1, FLOW_NEXT, 0},
+	[OP_DIVIDE_NUM_NUM]   = {true, 0, 2, 1, FLOW_NEXT, 0},
+	[OP_ADD_INT_INT]      = {true, 0, 2, 1, FLOW_NEXT, 0},
+	[OP_SUBTRACT_INT_INT] = {true, 0, 2, 1, FLOW_NEXT, 0},
+	[OP_MULTIPLY_INT_INT] = {true, 0, 2, 1, FLOW_NEXT, 0},
+
+	[OP_NOT]           = {true, 0, 1, 1, FLOW_NEXT, 0},
+	[OP_EQUAL]         = {true, 0, 2, 1, FLOW_NEXT, 0},
+	[OP_NOT_EQUAL]     = {true, 0, 2, 1, FLOW_NEXT, 0},
+	[OP_LESS]          = {true, 0, 2, 1, FLOW_NEXT, 0},
+	[OP_LESS_EQUAL]    = {true, 0, 2, 1, FLOW_NEXT, 0},
+	[OP_GREATER]       = {true, 0, 2, 1, FLOW_NEXT, 0},
+	[OP_GREATER_EQUAL] = {true, 0, 2, 1, FLOW_NEXT, 0},
+	[OP_POP]           = {true, 0, 1, 0, FLOW_NEXT, 0},
+	[OP_PRINT]         = {true, 0, 1, 0, FLOW_NEXT, 0},
+	[OP_GET_LOCAL]     = {true, 1, 0, 1, FLOW_NEXT, 0},
+	[OP_SET_LOCAL]     = {true, 1, 1, 1, FLOW_NEXT, 0},
+	[OP_GET_INPUT]     = {true, 1, 0, 1, FLOW_NEXT, 0},
+
+	[OP_JUMP]                = {true, 2, 0, 0, FLOW_JUMP,   0},
+	[OP_LOOP]                = {true, 2, 0, 0, FLOW_LOOP,   0},
+	[OP_JUMP_IF_FALSE]       = {true, 2, 1, 0, FLOW_BRANCH, 0},
+	[OP_JUMP_IF_FALSE_OR_POP] = {true, 2, 1, 0, FLOW_BRANCH, 1},
+	[OP_JUMP_IF_TRUE_OR_POP]  = {true, 2, 1, 0, FLOW_BRANCH, 1},
+
+	[OP_JUMP_IF_NOT_EQUAL]         = {true, 2, 2, 0, FLOW_BRANCH, 0},
+	[OP_JUMP_IF_EQUAL]             = {true, 2, 2, 0, FLOW_BRANCH, 0},
+	[OP_JUMP_IF_NOT_LESS]          = {true, 2, 2, 0, FLOW_BRANCH, 0},
+	[OP_JUMP_IF_NOT_LESS_EQUAL]    = {true, 2, 2, 0, FLOW_BRANCH, 0},
+	[OP_JUMP_IF_NOT_GREATER]       = {true, 2, 2, 0, FLOW_BRANCH, 0},
+	[OP_JUMP_IF_NOT_GREATER_EQUAL] = {true, 2, 2, 0, FLOW_BRANCH, 0},
+
+	// pops are the argument count operand, see argument_count()
+	[OP_CALL]      = {true, 2, 0, 1, FLOW_NEXT, 0},
+	[OP_TAIL_CALL] = {true, 2, 0, 0, FLOW_END,  0},
+	[OP_CALL_NATIVE]   = {true, 2, 0, 1, FLOW_NEXT, 0},
+	[OP_CALL_NATIVE_1] = {true, 1, 1, 1, FLOW_NEXT, 0},
+	[OP_CALL_NATIVE_2] = {true, 1, 2, 1, FLOW_NEXT, 0},
+
+	[OP_PICK]      = {true, 1, 0, 1, FLOW_NEXT, 0},
+	// pops are the operand plus the top, see argument_count()
+	[OP_SLIDE]     = {true, 1, 1, 1, FLOW_NEXT, 0},
+	// the body it compiles is verified on its own, see compile_function()
+	[OP_LAZY]      = {true, 1, 0, 0, FLOW_END,  0},
+
+	// pops are the operand, see argument_count()
+	[OP_ARRAY]      = {true, 1, 0, 1, FLOW_NEXT, 0},
+	[OP_ARRAY_FILL] = {true, 0, 2, 1, FLOW_NEXT, 0},
+	[OP_INDEX]      = {true, 0, 2, 1, FLOW_NEXT, 0},
+};
+
+static const uint opcode_info_size = sizeof(opcode_info) / sizeof(opcode_info[0]);
+
+//////////// static functions
+static verify_report_s verify(chunk_s*, const chunk_s*, const uint, int*);
+static verify_report_s make_report(const verify_result_e, const chunk_s*, const uint, const uint);
+static verify_result_e decode(const chunk_s*, bool*, uint*);
+static verify_result_e check_operands(const chunk_s*, const chunk_s*, const uint, const uint);
+static uint argument_count(const chunk_s*, const uint);
+static verify_result_e enter(int*, uint*, uint*, const uint, const uint);
+
+//////////// implementations
+
+verify_report_s verify_chunk(chunk_s* _chunk, const chunk_s* _script, const uint _arguments)
+{
+	return verify(_chunk, _script, _arguments, NULL);
+}
+
+verify_report_s verify_chunk_depths(chunk_s* _chunk, const chunk_s* _script, const uint _arguments, int* _depths)
+{
+	return verify(_chunk, _script, _arguments, _depths);
+}
+
+verify_report_s verify_program(chunk_s* _script)
+{
+	const functions_array_s* functions = &_script->functions;
+
+	verify_report_s report = verify_chunk(_script, _script, 0);
+	if(report.result != VERIFY_OK) return report;
+
+	// frames are stacked on top of each other, a callee's frame starts at
+	// its arguments which are already counted in the caller's depth. How
+	// many there are is up to run(), see fit_stack() in vm.c.
+	uint function_depth = 0;
+	for(uint i = 0; i < functions->size; ++i) {
+		function_s* function = functions->data[i];
+		verify_report_s function_report = verify_chunk(&function->chunk, _script, function->arity);
+		if(function_report.result != VERIFY_OK) return function_report;
+		if(function_report.max_depth > function_depth) function_depth = function_report.max_depth;
+	}
+
+	_script->frame_depth = function_depth;
+	return report;
+}
+
+const char* verify_result_message(const verify_result_e _result)
+{
+	switch(_result) {
+		case VERIFY_OK:						return "ok";
+		case VERIFY_EMPTY_CHUNK:			return "chunk is empty";
+		case VERIFY_BAD_OPCODE:				return "unknown opcode";
+		case VERIFY_TRUNCATED_INSTRUCTION:	return "instruction operands run past the end of the chunk";
+		case VERIFY_BAD_CONSTANT:			return "constant index out of range";
+		case VERIFY_BAD_LOCAL:				return "slot operand points below the stack";
+		case VERIFY_BAD_INPUT:				return "input index out of range";
+		case VERIFY_BAD_JUMP:				return "jump does not land on an instruction";
+		case VERIFY_BAD_CALL:				return "call to an unknown function or with the wrong number of arguments";
+		case VERIFY_BAD_NATIVE:				return "call to an unknown native or one of a different signature";
+		case VERIFY_STACK_UNDERFLOW:		return "instruction pops more values than the stack holds";
+		case VERIFY_STACK_MISMATCH:			return "paths reach an instruction with different stack depths";
+		case VERIFY_MISSING_RETURN:			return "execution can run off the end of the chunk";
+		default:							return "undefined verifier result";
+	}
+}
+
+int verify_report_line(const verify_report_s* _report)
+{
+	const chunk_s* chunk = _report->chunk;
+	if(!chunk || chunk->size == 0) return 0;
+	return chunk->lines[_report->offset < chunk->size ? _report->offset : chunk->size - 1];
+}
+
+//////////// static implementations
+// Two passes. decode() walks the chunk linearly to find where instructions
+// start, then the stack depth is propagated along every control flow edge.
+// Each reachable instruction gets exactly one depth, so a join with a
+// different depth on the other path is rejected.
+static verify_report_s verify(chunk_s* _chunk, const chunk_s* _script, const uint _arguments, int* _depths)
+{
+	_chunk->verified = false;
+	if(_chunk->size == 0) return make_report(VERIFY_EMPTY_CHUNK, _chunk, 0, 0);
+
+	verify_result_e result = VERIFY_OK;
+	uint offset = 0;
+	uint max_depth = _arguments;
+
+	bool* starts = (bool*)allocate_zeroed(sizeof(bool) * _chunk->size, MEMORY_SCRATCH);
+	int* depths = _depths ? _depths : ALLOCATE(int, _chunk->size, MEMORY_SCRATCH);
+	uint* worklist = ALLOCATE(uint, _chunk->size, MEMORY_SCRATCH);
+	uint worklist_size = 0;
+
+	result = decode(_chunk, starts, &offset);
+	if(result != VERIFY_OK) goto done;
+
+	for(uint i = 0; i < _chunk->size; ++i) depths[i] = -1;
+	depths[0] = (int)_arguments;
+	worklist[worklist_size++] = 0;
+
+	while(worklist_size > 0) {
+		offset = worklist[--worklist_size];
+
+		const uint8_t opcode = _chunk->data[offset];
+		const opcode_info_s* info = &opcode_info[opcode];
+		const uint depth = (uint)depths[offset];
+		const uint next = offset + 1 + info->operands;
+		const uint pops = info->pops + argument_count(_chunk, offset);
+
+		result = check_operands(_chunk, _script, offset, depth);
+		if(result != VERIFY_OK) goto done;
+
+		if(depth < pops) {
+			result = VERIFY_STACK_UNDERFLOW;
+			goto done;
+		}
+		const uint after = depth - pops + info->pushes;
+		if(after > max_depth) max_depth = after;
+
+		uint target = next;
+		if(info->flow == FLOW_JUMP || info->flow == FLOW_BRANCH || info->flow == FLOW_LOOP) {
+			const uint jump = (uint)((_chunk->data[offset + 1] << 8) | _chunk->data[offset + 2]);
+			if(info->flow == FLOW_LOOP) {
+				if(jump > next) {
+					result = VERIFY_BAD_JUMP;
+					goto done;
+				}
+				target = next - jump;
+			} else {
+				target = next + jump;
+			}
+
+			if(target >= _chunk->size || !starts[target]) {
+				result = VERIFY_BAD_JUMP;
+				goto done;
+			}
+		}
+
+		switch(info->flow) {
+			case FLOW_END:
+				break;
+			case FLOW_JUMP:
+			case FLOW_LOOP:
+				result = enter(depths, worklist, &worklist_size, target, after);
+				break;
+			case FLOW_BRANCH:
+				result = enter(depths, worklist, &worklist_size, target, after + info->jump_pushes);
+				if(after + info->jump_pushes > max_depth) max_depth = after + info->jump_pushes;
+				if(result != VERIFY_OK) break;
+				//fallthrough
+			case FLOW_NEXT:
+				if(next >= _chunk->size) {
+					result = VERIFY_MISSING_RETURN;
+					break;
+				}
+				result = enter(depths, worklist, &worklist_size, next, after);
+				break;
+		}
+		if(result != VERIFY_OK) goto done;
+	}
+
+	_chunk->verified = true;
+	_chunk->stack_depth = max_depth;
+	offset = 0;
+
+done:
+	FREE_ARRAY(bool, starts, _chunk->size, MEMORY_SCRATCH);
+	if(!_depths) FREE_ARRAY(int, depths, _chunk->size, MEMORY_SCRATCH);
+	FREE_ARRAY(uint, worklist, _chunk->size, MEMORY_SCRATCH);
+	return make_report(result, _chunk, offset, max_depth);
+}
+
+static verify_report_s make_report(const verify_result_e _result, const chunk_s* _chunk,
+								   const uint _offset, const uint _max_depth)
+{
+	verify_report_s ret_val;
+
+	ret_val.result	  = _result;
+	ret_val.chunk	  = _chunk;
+	ret_val.offset	  = _offset;
+	ret_val.max_depth = _max_depth;
+
+	return ret_val;
+}
+
+static verify_result_e decode(const chunk_s* _chunk, bool* _starts, uint* _offset)
+{
+	uint offset = 0;
+	while(offset < _chunk->size) {
+		*_offset = offset;
+		const uint8_t opcode = _chunk->data[offset];
+		if(opcode >= opcode_info_size || !opcode_info[opcode].valid) return VERIFY_BAD_OPCODE;
+
+		if(offset + opcode_info[opcode].operands >= _chunk->size) return VERIFY_TRUNCATED_INSTRUCTION;
+
+		_starts[offset] = true;
+		offset += 1 + opcode_info[opcode].operands;
+	}
+	return VERIFY_OK;
+}
+
+static verify_result_e check_operands(const chunk_s* _chunk, const chunk_s* _script,
+									  const uint _offset, const uint _depth)
+{
+	const functions_array_s* functions = &_script->functions;
+	switch(_chunk->data[_offset]) {
+		case OP_CALL:
+		case OP_TAIL_CALL: {
+			const uint8_t index = _chunk->data[_offset + 1];
+			if(index >= functions->size) return VERIFY_BAD_CALL;
+			if(functions->data[index]->arity != _chunk->data[_offset + 2]) return VERIFY_BAD_CALL;
+			break;
+		}
+		case OP_CALL_NATIVE:
+		case OP_CALL_NATIVE_1:
+		case OP_CALL_NATIVE_2: {
+			static const native_kind_e kinds[] = {NATIVE_GENERIC, NATIVE_NUMBER_1, NATIVE_NUMBER_2};
+			const uint8_t opcode = _chunk->data[_offset];
+			const uint8_t index = _chunk->data[_offset + 1];
+			if(index >= native_count || natives[index].kind != kinds[opcode - OP_CALL_NATIVE]) return VERIFY_BAD_NATIVE;
+			if(opcode == OP_CALL_NATIVE && natives[index].arity != _chunk->data[_offset + 2]) return VERIFY_BAD_NATIVE;
+			break;
+		}
+		case OP_CONSTANT:
+			if(_chunk->data[_offset + 1] >= _chunk->literals.size) return VERIFY_BAD_CONSTANT;
+			break;
+		// run() takes the function to be the one it is the code of
+		case OP_LAZY: {
+			const uint8_t index = _chunk->data[_offset + 1];
+			if(index >= functions->size || &functions->data[index]->chunk != _chunk || !functions->data[index]->lazy) return VERIFY_BAD_CALL;
+			break;
+		}
+		case OP_GET_LOCAL:
+		case OP_SET_LOCAL:
+		case OP_PICK:
+			if(_chunk->data[_offset + 1] >= _depth) return VERIFY_BAD_LOCAL;
+			break;
+		case OP_GET_INPUT:
+			if(_chunk->data[_offset + 1] >= _script->inputs.size) return VERIFY_BAD_INPUT;
+			break;
+		default: break;
+	}
+	return VERIFY_OK;
+}
+
+static uint argument_count(const chunk_s* _chunk, const uint _offset)
+{
+	const uint8_t opcode = _chunk->data[_offset];
+	if(opcode == OP_CALL || opcode == OP_TAIL_CALL || opcode == OP_CALL_NATIVE) return _chunk->data[_offset + 2];
+	if(opcode == OP_SLIDE || opcode == OP_ARRAY) return _chunk->data[_offset + 1];
+	return 0;
+}
+
+static verify_result_e enter(int* _depths, uint* _worklist, uint* _worklist_size,
+							 const uint _offset, const uint _depth)
+{
+	if(_depths[_offset] == -1) {
+		_depths[_offset] = (int)_depth;
+		_worklist[(*_worklist_size)++] = _offset;
+		return VERIFY_OK;
+	}
+	return (_depths[_offset] == (int)_depth) ? VERIFY_OK : VERIFY_STACK_MISMATCH;
+}
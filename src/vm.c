@@ -2,134 +2,1163 @@
 
 #include "../include/debug.h"
 #include "../include/compiler.h"
+#include "../include/verifier.h"
+#include "../include/cache.h"
+#include "../include/native.h"
+#include "../include/aot.h"
+#include "../include/memory.h"
+#include "../include/perf.h"
+#include "../include/array.h"
 
-#define DEBUG_TRACE_EXECUTION
-#define DEBUG_PRINT_CODE
+//#define DEBUG_TRACE_EXECUTION
+//#define DEBUG_PRINT_CODE
+
+// a vm collects its arrays once they take this much, or twice what was
+// left after the last collection
+#define ARRAYS_COLLECT_MIN (1u << 20)
+// spares looked at for one of the right length, loops tend to make the
+// same lengths in the same order
+#define ARRAYS_REUSE_SEARCH 8
+// frames a vm starts with, they double up to FRAMES_MAX as calls go deeper
+#define FRAMES_MIN 16
 
 
 //////////////////////// global vm state
 vm_s vm;
+static dispatch_e dispatch = DISPATCH_PLAIN;
 
 //////////////////////// helper functions
-static interpret_result_e run();
+static interpret_result_e run(vm_s*);
 
-static value_t pop();
-static void push(value_t);
-static void reset_stack();
+static void reset_stack(vm_s*);
+static void runtime_error(vm_s*, const char*);
+static opcode_e specialize(const opcode_e, const value_t, const value_t);
+static void rewrite_instruction(uint8_t*, const opcode_e);
+static void reserve_stack(vm_s*, const uint);
+static void grow_stack(vm_s*, const uint);
+static void grow_frames(vm_s*);
+static void fit_stack(vm_s*);
+static array_s* new_vm_array(vm_s*, const uint);
+static void collect_arrays(vm_s*);
+static array_s* reuse_array(vm_s*, const uint);
+static void free_arrays(vm_s*);
+static const char* broadcast(vm_s*, const opcode_e, const value_t, const value_t, value_t*);
+static bool whole_number(const value_t, int64_t*);
 
 //////////////////////// implementations
 void vm_init()
 {
-	vm.sp = vm.stack;
+	vm.stack = NULL;
+	vm.stack_capacity = 0;
+	vm.frames = NULL;
+	vm.frame_capacity = 0;
+	vm.slice = 0;
+	vm.dispatched = 0;
+	vm.arrays = NULL;
+	vm.spares = NULL;
+	vm.array_bytes = 0;
+	vm.collect_at = ARRAYS_COLLECT_MIN;
+	reset_stack(&vm);
 }
 
 void vm_free()
 {
-	//nuthin to be done here (yet...)
+	free_cache();
+	free_arrays(&vm);
+	FREE_ARRAY(value_t, vm.stack, vm.stack_capacity, MEMORY_STACK);
+	FREE_ARRAY(call_frame_s, vm.frames, vm.frame_capacity, MEMORY_STACK);
+	vm.stack = NULL;
+	vm.stack_capacity = 0;
+	vm.frames = NULL;
+	vm.frame_capacity = 0;
+	reset_stack(&vm);
 }
 
+// the same source comes back a lot (a repl session, a service), so compiled
+// programs are kept in the cache and only run again on a hit
 interpret_result_e vm_interpret(const char* _code)
 {
-	chunk_s chunk;
-	init_chunk(&chunk);
-	if(!compile(_code, &chunk)) {
-		free_chunk(&chunk);
-		return INTERPRETER_COMPILER_ERROR;
+	const compiler_options_s options = get_compiler_options();
+	cache_entry_s* entry = cache_lookup(_code, options.optimization_level, options.lazy);
+
+	if(!entry) {
+		chunk_s chunk;
+		init_chunk(&chunk);
+		perf_begin(PERF_COMPILE);
+		const bool compiled = compile(_code, &chunk);
+		perf_end(PERF_COMPILE, 0);
+		if(!compiled) {
+			free_chunk(&chunk);
+			return INTERPRETER_COMPILER_ERROR;
+		}
+
+		verify_report_s report = verify_program(&chunk);
+		if(report.result != VERIFY_OK) {
+			fprintf(stderr, "[line %d] Verification error at %04d: %s\n",
+					verify_report_line(&report), report.offset, verify_result_message(report.result));
+			free_chunk(&chunk);
+			return INTERPRETER_VERIFIER_ERROR;
+		}
+
+		entry = cache_insert(_code, options.optimization_level, options.lazy, &chunk, report.max_depth);
 	}
 
-	vm.chunk = &chunk;
-	vm.pc = vm.chunk->data;
+	// only the global vm uses the cache, so nobody else touches native here
+	if(get_aot_options().enabled && !entry->native_tried) {
+		entry->native_tried = true;
+		entry->native = aot_load(&entry->chunk);
+	}
 
-	interpret_result_e result = run();
+	const uint64_t dispatched = vm.dispatched;
+	perf_begin(PERF_RUN);
+	interpret_result_e result = entry->native
+		? aot_run(entry->native, NULL, &vm.result)
+		: vm_run(&vm, &entry->chunk, entry->stack_depth, NULL);
+	perf_end(PERF_RUN, vm.dispatched - dispatched);
+	if(result == INTERPRETER_OK) {
+		printf("returning value: ");
+		print_value(vm.result);
+		printf("\n");
+	}
+
+#ifdef DEBUG_PRINT_CODE
+	disassemble_chunk(&entry->chunk, "quickened");
+#endif
 
-	free_chunk(&chunk);
+	cache_release(entry);
 	return result;
 }
 
+vm_s* new_vm()
+{
+	vm_s* instance = ALLOCATE(vm_s, 1, MEMORY_HANDLES);
+	instance->stack = NULL;
+	instance->stack_capacity = 0;
+	instance->frames = NULL;
+	instance->frame_capacity = 0;
+	instance->inputs = NULL;
+	instance->slice = 0;
+	instance->dispatched = 0;
+	instance->arrays = NULL;
+	instance->spares = NULL;
+	instance->array_bytes = 0;
+	instance->collect_at = ARRAYS_COLLECT_MIN;
+	reset_stack(instance);
+	return instance;
+}
+
+void free_vm(vm_s* _vm)
+{
+	free_arrays(_vm);
+	FREE_ARRAY(value_t, _vm->stack, _vm->stack_capacity, MEMORY_STACK);
+	FREE_ARRAY(call_frame_s, _vm->frames, _vm->frame_capacity, MEMORY_STACK);
+	FREE(vm_s, _vm, MEMORY_HANDLES);
+}
+
+interpret_result_e vm_run(vm_s* _vm, chunk_s* _script, const uint _stack_depth, const value_t* _inputs)
+{
+	if(_vm->frame_capacity == 0) {
+		_vm->frames = ALLOCATE(call_frame_s, FRAMES_MIN, MEMORY_STACK);
+		_vm->frame_capacity = FRAMES_MIN;
+	}
+	// what fit_stack() asks for, while nothing is on the stack yet
+	_vm->frame_depth = _script->frame_depth;
+	reserve_stack(_vm, _stack_depth + _script->frame_depth * (_vm->frame_capacity - 1));
+	reset_stack(_vm);
+	free_arrays(_vm);
+
+	_vm->chunk = _script;
+	_vm->pc = _script->data;
+	_vm->base = _vm->stack;
+	_vm->functions = &_script->functions;
+	_vm->inputs = _inputs;
+	_vm->frames[0].chunk = _vm->chunk;
+	_vm->frames[0].base = _vm->base;
+	_vm->frame_count = 1;
+
+	return vm_resume(_vm);
+}
+
+void vm_set_slice(vm_s* _vm, const uint64_t _slice)
+{
+	_vm->slice = _slice;
+}
+
+interpret_result_e vm_resume(vm_s* _vm)
+{
+	_vm->slice_left = _vm->slice == 0 ? INT64_MAX : (int64_t)_vm->slice;
+	return run(_vm);
+}
+
+void set_dispatch(const dispatch_e _dispatch)
+{
+	dispatch = _dispatch;
+}
+
+dispatch_e get_dispatch()
+{
+	return dispatch;
+}
+
 //////////////////////// helper implementations
-static interpret_result_e run()
+// only ever runs verified chunks - every operand, constant index and stack
+// access has been proven in bounds up front, so nothing is checked in here
+//
+// With DISPATCH_CACHED the top one or two values live in r0 (the top) and r1
+// (the one below it) instead of vm->stack, and the switch is on the opcode
+// together with how many of them are cached. Pushes and pops in straight
+// line code then move values between those two and memory is only touched
+// once the stack goes deeper. Opcodes without a handler for the state spill
+// the registers and run the plain one, so does everything that calls,
+// allocates or otherwise looks at the stack in memory. Every return with a
+// stack that is still needed spills first, vm_resume() starts with nothing
+// cached.
+static interpret_result_e run(vm_s* vm)
 {
 	//it's this stupid ass syntax, that evaluates this shit and returns last thing in bracket
-#define READ_BYTE()				(*vm.pc++)
-#define READ_CONSTANT()			(vm.chunk->literals.data[READ_BYTE()])
-#define BINARY_OPERATION(sign)	do {					\
-									double b = pop();   \
-									double a = pop();   \
-									push(a sign b);	    \
-								}while(0)
-
-	interpret_result_e ret_val = INTERPRETER_UNDEFINED;
+#define READ_BYTE()				(*pc++)
+#define READ_OPCODE()			(__atomic_load_n(pc++, __ATOMIC_RELAXED))
+#define READ_CONSTANT()			(vm->chunk->literals.data[READ_BYTE()])
+#define READ_SHORT()			(pc += 2, (uint16_t)((pc[-2] << 8) | pc[-1]))
+#define PUSH(value)				do { value_t pushed = (value); *sp++ = pushed; } while(0)
+#define POP()					(*--sp)
+#define PEEK(distance)			(sp[-1 - (int)(distance)])
+	// pc and sp are locals of run(), *vm only gets them back where somebody
+	// else looks: a yield, a runtime error, growing the stack and the
+	// collection of new_vm_array(). A call keeps pc in its frame.
+#define SAVE_REGISTERS()		do { vm->pc = pc; vm->sp = sp; } while(0)
+#define CHARGE_SLICE(cost)		do {											\
+		if((vm->slice_left -= (cost)) <= 0) {										\
+			SAVE_REGISTERS();														\
+			return INTERPRETER_YIELD;												\
+		}																			\
+	}while(0)
+#define RUNTIME_ERROR(message)	do {											\
+		SAVE_REGISTERS();															\
+		runtime_error(vm, message);													\
+		return INTERPRETER_RUNTIME_ERROR;											\
+	}while(0)
+	// guard of a quickened opcode: on a type miss put the generic opcode
+	// back and dispatch it again, it will pick a better fit (or fail)
+#define BINARY_NUMBER_OPERATION(sign, generic)	do {								\
+		value_t b = PEEK(0);														\
+		value_t a = PEEK(1);														\
+		if(!IS_NUMBER(a) || !IS_NUMBER(b)) {										\
+			rewrite_instruction(pc - 1, generic);									\
+			--pc;																	\
+			break;																	\
+		}																			\
+		--sp;																		\
+		sp[-1] = NUMBER_VAL(AS_NUMBER(a) sign AS_NUMBER(b));						\
+	}while(0)
+	// same for ints, except that an overflow isn't a miss: the result of
+	// that one operation is a double and the opcode stays
+#define BINARY_INT_OPERATION(overflows, sign, generic)	do {						\
+		value_t b = PEEK(0);														\
+		value_t a = PEEK(1);														\
+		if(!IS_INT(a) || !IS_INT(b)) {												\
+			rewrite_instruction(pc - 1, generic);									\
+			--pc;																	\
+			break;																	\
+		}																			\
+		int64_t result;																\
+		--sp;																		\
+		if(overflows(AS_INT(a), AS_INT(b), &result)) {								\
+			sp[-1] = NUMBER_VAL((double)AS_INT(a) sign (double)AS_INT(b));			\
+		} else {																	\
+			sp[-1] = INT_VAL(result);												\
+		}																			\
+	}while(0)
+	// ints are compared as ints and doubles as doubles, a mix of both is
+	// compared exactly by compare_values()
+#define COMPARE(a, b, sign, holds)	do {											\
+		if(IS_INT(a) && IS_INT(b)) {												\
+			holds = AS_INT(a) sign AS_INT(b);										\
+		} else if(IS_NUMBER(a) && IS_NUMBER(b)) {									\
+			holds = AS_NUMBER(a) sign AS_NUMBER(b);									\
+		} else if(IS_NUMERIC(a) && IS_NUMERIC(b)) {									\
+			int order = compare_values(a, b);										\
+			holds = order != 2 && order sign 0;										\
+		} else {																	\
+			RUNTIME_ERROR("operands must be numbers");								\
+		}																			\
+	}while(0)
+
+#define COMPARISON_OPERATION(sign)	do {											\
+		value_t b = POP();															\
+		value_t a = POP();															\
+		bool holds;																	\
+		COMPARE(a, b, sign, holds);													\
+		PUSH(BOOL_VAL(holds));														\
+	}while(0)
+	// fused compare-and-branch, jumps when the comparison does NOT hold
+#define JUMP_UNLESS_COMPARISON(sign)	do {										\
+		uint16_t offset = READ_SHORT();												\
+		value_t b = POP();															\
+		value_t a = POP();															\
+		bool holds;																	\
+		COMPARE(a, b, sign, holds);													\
+		if(!holds) pc += offset;													\
+	}while(0)
+
+	// states of the cached dispatch, or'ed to the opcode. The plain one is 0
+	// and stays that way, its handlers are the cases with the bare opcode.
+#define TOS_0	0x100	// nothing cached
+#define TOS_1	0x200	// the top in r0
+#define TOS_2	0x300	// the top in r0, the one below it in r1
+#define FALLTHROUGH			__attribute__((fallthrough))
+#define CACHE_ONE()			do { r0 = *--sp; state = TOS_1; } while(0)
+#define CACHE_TWO()			do { r1 = *--sp; state = TOS_2; } while(0)
+#define FLUSH()				do {													\
+		if(state == TOS_2) *sp++ = r1;												\
+		if(state >= TOS_1) *sp++ = r0;												\
+		state = TOS_0;																\
+	}while(0)
+	// the plain handler of this instruction, on the spilled stack
+#define FALLBACK()			do { FLUSH(); key = instruction; goto redispatch; } while(0)
+#define PUSH_0(value)		do { r0 = (value); state = TOS_1; } while(0)
+#define PUSH_1(value)		do { value_t pushed = (value); r1 = r0; r0 = pushed; state = TOS_2; } while(0)
+#define PUSH_2(value)		do { value_t pushed = (value); *sp++ = r1; r1 = r0; r0 = pushed; } while(0)
+#define DROP_TOP()			do {													\
+		if(state == TOS_2) {														\
+			r0 = r1;																\
+			state = TOS_1;															\
+		} else {																	\
+			state = TOS_0;															\
+		}																			\
+	}while(0)
+	// handlers of one or two operands start with both in registers, the
+	// states with fewer load them and fall through
+#define UNARY_CASES(opcode)															\
+	case TOS_0 | opcode: CACHE_ONE(); FALLTHROUGH;									\
+	case TOS_1 | opcode:															\
+	case TOS_2 | opcode
+#define BINARY_CASES(opcode)														\
+	case TOS_0 | opcode: CACHE_ONE(); FALLTHROUGH;									\
+	case TOS_1 | opcode: CACHE_TWO(); FALLTHROUGH;									\
+	case TOS_2 | opcode
+	// BINARY_NUMBER_OPERATION and friends on r1 and r0, a miss keeps both
+	// cached and the generic opcode falls back
+#define CACHED_NUMBER_OPERATION(sign, generic)	do {								\
+		if(!IS_NUMBER(r1) || !IS_NUMBER(r0)) {										\
+			rewrite_instruction(pc - 1, generic);									\
+			--pc;																	\
+			break;																	\
+		}																			\
+		r0 = NUMBER_VAL(AS_NUMBER(r1) sign AS_NUMBER(r0));							\
+		state = TOS_1;																\
+	}while(0)
+#define CACHED_INT_OPERATION(overflows, sign, generic)	do {						\
+		if(!IS_INT(r1) || !IS_INT(r0)) {											\
+			rewrite_instruction(pc - 1, generic);									\
+			--pc;																	\
+			break;																	\
+		}																			\
+		int64_t result;																\
+		r0 = overflows(AS_INT(r1), AS_INT(r0), &result)								\
+			? NUMBER_VAL((double)AS_INT(r1) sign (double)AS_INT(r0))				\
+			: INT_VAL(result);														\
+		state = TOS_1;																\
+	}while(0)
+#define CACHED_COMPARISON(sign)	do {												\
+		bool holds;																	\
+		COMPARE(r1, r0, sign, holds);												\
+		r0 = BOOL_VAL(holds);														\
+		state = TOS_1;																\
+	}while(0)
+#define CACHED_JUMP_UNLESS_COMPARISON(sign)	do {									\
+		uint16_t offset = READ_SHORT();												\
+		bool holds;																	\
+		COMPARE(r1, r0, sign, holds);												\
+		state = TOS_0;																\
+		if(!holds) pc += offset;													\
+	}while(0)
+
+	uint8_t* pc = vm->pc;
+	value_t* sp = vm->sp;
 	instruction_t instruction;
-	uint offset = 0;
+	uint key;
+	uint state = dispatch == DISPATCH_CACHED ? TOS_0 : 0;
+	value_t r0 = NIL_VAL;
+	value_t r1 = NIL_VAL;
 
-	while((instruction = READ_BYTE()) != 0) {
+	while(true) {
+		instruction = READ_OPCODE();
+		++vm->dispatched;
 
 #ifdef DEBUG_TRACE_EXECUTION
 		printf("	stack: [");
-		for(value_t* value = vm.stack; value < vm.sp; ++value) {
-			printf("%g, ", *value);
+		for(value_t* value = vm->stack; value < sp; ++value) {
+			print_value(*value);
+			printf(", ");
+		}
+		if(state == TOS_2) {
+			print_value(r1);
+			printf(", ");
+		}
+		if(state >= TOS_1) {
+			print_value(r0);
+			printf(", ");
 		}
 		printf("]\n");
-		offset = disassemble_instruction(vm.chunk, offset);
+		disassemble_instruction(vm->chunk, (uint)(pc - 1 - vm->chunk->data));
 #endif
-		switch(instruction)
+		key = instruction | state;
+	redispatch:
+		switch(key)
 		{
 			case OP_RETURN: {
-				printf("returning value: %g\n", pop());
-				ret_val = INTERPRETER_OK;
+				value_t result = POP();
+				if(--vm->frame_count == 0) {
+					vm->result = result;
+					return INTERPRETER_OK;
+				}
+
+				sp = vm->base;
+				PUSH(result);
+
+				call_frame_s* frame = &vm->frames[vm->frame_count - 1];
+				vm->chunk = frame->chunk;
+				vm->base  = frame->base;
+				pc    = frame->pc;
+				break;
+			}
+			case OP_CALL: {
+				function_s* function = vm->functions->data[READ_BYTE()];
+				uint8_t argument_count = READ_BYTE();
+				// the one check that can't be proven up front, recursion depth.
+				// The stack has room for every frame there is, it grows with them.
+				if(vm->frame_count == vm->frame_capacity) {
+					if(vm->frame_capacity == FRAMES_MAX) RUNTIME_ERROR("stack overflow");
+					SAVE_REGISTERS();
+					grow_frames(vm);
+					sp = vm->sp;
+				}
+
+				vm->frames[vm->frame_count - 1].pc = pc;
+
+				call_frame_s* frame = &vm->frames[vm->frame_count++];
+				frame->chunk = vm->chunk = &function->chunk;
+				frame->base	 = vm->base  = sp - argument_count;
+				pc = vm->chunk->data;
+				CHARGE_SLICE(function->chunk.size);
+				break;
+			}
+			case OP_TAIL_CALL: {
+				function_s* function = vm->functions->data[READ_BYTE()];
+				uint8_t argument_count = READ_BYTE();
+
+				memmove(vm->base, sp - argument_count, sizeof(value_t) * argument_count);
+				sp = vm->base + argument_count;
+
+				vm->frames[vm->frame_count - 1].chunk = vm->chunk = &function->chunk;
+				pc = vm->chunk->data;
+				CHARGE_SLICE(function->chunk.size);
+				break;
+			}
+			// the call already set up the frame, only the code is missing
+			case OP_LAZY: {
+				chunk_s* script = vm->frames[0].chunk;
+				chunk_s* body = compile_function(script, vm->functions->data[READ_BYTE()]);
+				if(!body) {
+					RUNTIME_ERROR("the called function doesn't compile");
+				}
+				vm->frames[vm->frame_count - 1].chunk = vm->chunk = body;
+				// the stack was sized without this body, a deeper one needs room
+				// for itself and every frame that could still be pushed
+				if(body->stack_depth > vm->frame_depth) {
+					vm->frame_depth = body->stack_depth;
+					SAVE_REGISTERS();
+					fit_stack(vm);
+					sp = vm->sp;
+				}
+				pc = body->data;
+				CHARGE_SLICE(body->size);
+				break;
+			}
+			case OP_CALL_NATIVE: {
+				const native_s* native = &natives[READ_BYTE()];
+				uint8_t argument_count = READ_BYTE();
+				value_t* arguments = sp - argument_count;
+				value_t result;
+				if(!native->as.generic(arguments, &result)) {
+					RUNTIME_ERROR("native function failed");
+				}
+				sp = arguments;
+				PUSH(result);
+				break;
+			}
+			case OP_CALL_NATIVE_1: {
+				native_number_1_t function = natives[READ_BYTE()].as.number_1;
+				if(!IS_NUMERIC(sp[-1])) {
+					RUNTIME_ERROR("argument must be a number");
+				}
+				sp[-1] = NUMBER_VAL(function(AS_FLOAT(sp[-1])));
+				break;
+			}
+			case OP_CALL_NATIVE_2: {
+				native_number_2_t function = natives[READ_BYTE()].as.number_2;
+				value_t b = PEEK(0);
+				value_t a = PEEK(1);
+				if(!IS_NUMERIC(a) || !IS_NUMERIC(b)) {
+					RUNTIME_ERROR("arguments must be numbers");
+				}
+				--sp;
+				sp[-1] = NUMBER_VAL(function(AS_FLOAT(a), AS_FLOAT(b)));
 				break;
 			}
 			case OP_CONSTANT: {
 				value_t constant = READ_CONSTANT();
-				push(constant);
+				PUSH(constant);
 				break;
 			}
-			case OP_ADD: {
-				BINARY_OPERATION(+);
+			case OP_NIL:   PUSH(NIL_VAL);		  break;
+			case OP_TRUE:  PUSH(BOOL_VAL(true));  break;
+			case OP_FALSE: PUSH(BOOL_VAL(false)); break;
+			case OP_ADD:
+			case OP_SUBTRACT:
+			case OP_MULTIPLY:
+			case OP_DIVIDE: {
+				value_t b = PEEK(0);
+				value_t a = PEEK(1);
+				opcode_e specialized = specialize(instruction, a, b);
+				if(specialized != instruction) {
+					rewrite_instruction(pc - 1, specialized);
+					--pc;
+					break;
+				}
+				// one dispatch for the whole array, the kernel does the rest
+				if(IS_ARRAY(a) || IS_ARRAY(b)) {
+					value_t result;
+					SAVE_REGISTERS();
+					const char* failure = broadcast(vm, instruction, a, b, &result);
+					if(failure) {
+						RUNTIME_ERROR(failure);
+					}
+					--sp;
+					sp[-1] = result;
+					break;
+				}
+				// no quickened form for a mix of ints and doubles or for
+				// dividing ints, those are done right here every time
+				if(!IS_NUMERIC(a) || !IS_NUMERIC(b)) {
+					RUNTIME_ERROR("operands must be numbers");
+				}
+				--sp;
+				switch(instruction) {
+					case OP_ADD:	  sp[-1] = add_values(a, b);	  break;
+					case OP_SUBTRACT: sp[-1] = subtract_values(a, b); break;
+					case OP_MULTIPLY: sp[-1] = multiply_values(a, b); break;
+					default:		  sp[-1] = divide_values(a, b);	  break;
+				}
 				break;
 			}
-			case OP_SUBTRACT: {
-				BINARY_OPERATION(-);
+			case OP_ADD_NUM_NUM: {
+				BINARY_NUMBER_OPERATION(+, OP_ADD);
 				break;
 			}
-			case OP_MULTIPLY: {
-				BINARY_OPERATION(*);
+			case OP_SUBTRACT_NUM_NUM: {
+				BINARY_NUMBER_OPERATION(-, OP_SUBTRACT);
 				break;
 			}
-			case OP_DIVIDE: {
-				BINARY_OPERATION(/);
+			case OP_MULTIPLY_NUM_NUM: {
+				BINARY_NUMBER_OPERATION(*, OP_MULTIPLY);
+				break;
+			}
+			case OP_DIVIDE_NUM_NUM: {
+				BINARY_NUMBER_OPERATION(/, OP_DIVIDE);
+				break;
+			}
+			case OP_ADD_INT_INT: {
+				BINARY_INT_OPERATION(__builtin_add_overflow, +, OP_ADD);
+				break;
+			}
+			case OP_SUBTRACT_INT_INT: {
+				BINARY_INT_OPERATION(__builtin_sub_overflow, -, OP_SUBTRACT);
+				break;
+			}
+			case OP_MULTIPLY_INT_INT: {
+				BINARY_INT_OPERATION(__builtin_mul_overflow, *, OP_MULTIPLY);
 				break;
 			}
 			case OP_NEGATION: {
-				push(-pop());
+				if(IS_NUMBER(PEEK(0))) {
+					sp[-1] = NUMBER_VAL(-AS_NUMBER(sp[-1]));
+				} else if(IS_INT(PEEK(0))) {
+					sp[-1] = negate_value(sp[-1]);
+				} else if(IS_ARRAY(PEEK(0))) {
+					const array_s* operand = AS_ARRAY(PEEK(0));
+					SAVE_REGISTERS();
+					array_s* array = new_vm_array(vm, operand->length);
+					array_negate(array->data, operand->data, operand->length);
+					sp[-1] = ARRAY_VAL(array);
+				} else {
+					RUNTIME_ERROR("operand must be a number");
+				}
+				break;
+			}
+			case OP_NOT: {
+				sp[-1] = BOOL_VAL(is_falsey(sp[-1]));
+				break;
+			}
+			case OP_EQUAL: {
+				value_t b = POP();
+				value_t a = POP();
+				PUSH(BOOL_VAL(values_equal(a, b)));
+				break;
+			}
+			case OP_NOT_EQUAL: {
+				value_t b = POP();
+				value_t a = POP();
+				PUSH(BOOL_VAL(!values_equal(a, b)));
+				break;
+			}
+			case OP_LESS:		   COMPARISON_OPERATION(<);	 break;
+			case OP_LESS_EQUAL:	   COMPARISON_OPERATION(<=); break;
+			case OP_GREATER:	   COMPARISON_OPERATION(>);	 break;
+			case OP_GREATER_EQUAL: COMPARISON_OPERATION(>=); break;
+			case OP_POP: {
+				--sp;
+				break;
+			}
+			case OP_PRINT: {
+				print_value(POP());
+				printf("\n");
+				break;
+			}
+			case OP_GET_LOCAL: {
+				uint8_t slot = READ_BYTE();
+				PUSH(vm->base[slot]);
+				break;
+			}
+			case OP_SET_LOCAL: {
+				uint8_t slot = READ_BYTE();
+				vm->base[slot] = PEEK(0);
+				break;
+			}
+			case OP_GET_INPUT: {
+				uint8_t index = READ_BYTE();
+				PUSH(vm->inputs[index]);
+				break;
+			}
+			case OP_PICK: {
+				uint8_t distance = READ_BYTE();
+				PUSH(PEEK(distance));
+				break;
+			}
+			case OP_SLIDE: {
+				uint8_t count = READ_BYTE();
+				value_t top = POP();
+				sp -= count;
+				PUSH(top);
+				break;
+			}
+			case OP_JUMP: {
+				uint16_t offset = READ_SHORT();
+				pc += offset;
+				break;
+			}
+			case OP_LOOP: {
+				uint16_t offset = READ_SHORT();
+				pc -= offset;
+				CHARGE_SLICE(offset);
+				break;
+			}
+			case OP_JUMP_IF_FALSE: {
+				uint16_t offset = READ_SHORT();
+				if(is_falsey(POP())) pc += offset;
+				break;
+			}
+			case OP_JUMP_IF_FALSE_OR_POP: {
+				uint16_t offset = READ_SHORT();
+				if(is_falsey(PEEK(0))) pc += offset;
+				else --sp;
+				break;
+			}
+			case OP_JUMP_IF_TRUE_OR_POP: {
+				uint16_t offset = READ_SHORT();
+				if(!is_falsey(PEEK(0))) pc += offset;
+				else --sp;
+				break;
+			}
+			case OP_JUMP_IF_NOT_EQUAL: {
+				uint16_t offset = READ_SHORT();
+				value_t b = POP();
+				value_t a = POP();
+				if(!values_equal(a, b)) pc += offset;
 				break;
 			}
+			case OP_JUMP_IF_EQUAL: {
+				uint16_t offset = READ_SHORT();
+				value_t b = POP();
+				value_t a = POP();
+				if(values_equal(a, b)) pc += offset;
+				break;
+			}
+			case OP_JUMP_IF_NOT_LESS:		   JUMP_UNLESS_COMPARISON(<);  break;
+			case OP_JUMP_IF_NOT_LESS_EQUAL:	   JUMP_UNLESS_COMPARISON(<=); break;
+			case OP_JUMP_IF_NOT_GREATER:	   JUMP_UNLESS_COMPARISON(>);  break;
+			case OP_JUMP_IF_NOT_GREATER_EQUAL: JUMP_UNLESS_COMPARISON(>=); break;
+			case OP_ARRAY: {
+				uint8_t count = READ_BYTE();
+				value_t* elements = sp - count;
+				for(uint i = 0; i < count; ++i) {
+					if(!IS_NUMERIC(elements[i])) {
+						RUNTIME_ERROR("array elements must be numbers");
+					}
+				}
+				SAVE_REGISTERS();
+				array_s* array = new_vm_array(vm, count);
+				for(uint i = 0; i < count; ++i) array->data[i] = AS_FLOAT(elements[i]);
+				sp = elements;
+				PUSH(ARRAY_VAL(array));
+				break;
+			}
+			case OP_ARRAY_FILL: {
+				value_t value = PEEK(1);
+				int64_t length;
+				if(!IS_NUMERIC(value)) {
+					RUNTIME_ERROR("array elements must be numbers");
+				}
+				if(!whole_number(PEEK(0), &length) || length < 0 || length > ARRAY_LENGTH_MAX) {
+					RUNTIME_ERROR("array length out of range");
+				}
+				SAVE_REGISTERS();
+				array_s* array = new_vm_array(vm, (uint)length);
+				const double element = AS_FLOAT(value);
+				for(uint i = 0; i < array->length; ++i) array->data[i] = element;
+				--sp;
+				sp[-1] = ARRAY_VAL(array);
+				break;
+			}
+			case OP_INDEX: {
+				value_t index = POP();
+				value_t array = PEEK(0);
+				int64_t at;
+				if(!IS_ARRAY(array)) {
+					RUNTIME_ERROR("only arrays can be indexed");
+				}
+				if(!whole_number(index, &at) || at < 0 || at >= AS_ARRAY(array)->length) {
+					RUNTIME_ERROR("array index out of range");
+				}
+				sp[-1] = NUMBER_VAL(AS_ARRAY(array)->data[at]);
+				break;
+			}
+			//////// DISPATCH_CACHED, the plain handlers above do the rest
+			case TOS_0 | OP_CONSTANT: PUSH_0(READ_CONSTANT()); break;
+			case TOS_1 | OP_CONSTANT: PUSH_1(READ_CONSTANT()); break;
+			case TOS_2 | OP_CONSTANT: PUSH_2(READ_CONSTANT()); break;
+			case TOS_0 | OP_NIL:	  PUSH_0(NIL_VAL);		   break;
+			case TOS_1 | OP_NIL:	  PUSH_1(NIL_VAL);		   break;
+			case TOS_2 | OP_NIL:	  PUSH_2(NIL_VAL);		   break;
+			case TOS_0 | OP_TRUE:	  PUSH_0(BOOL_VAL(true));  break;
+			case TOS_1 | OP_TRUE:	  PUSH_1(BOOL_VAL(true));  break;
+			case TOS_2 | OP_TRUE:	  PUSH_2(BOOL_VAL(true));  break;
+			case TOS_0 | OP_FALSE:	  PUSH_0(BOOL_VAL(false)); break;
+			case TOS_1 | OP_FALSE:	  PUSH_1(BOOL_VAL(false)); break;
+			case TOS_2 | OP_FALSE:	  PUSH_2(BOOL_VAL(false)); break;
+			case TOS_0 | OP_GET_INPUT: PUSH_0(vm->inputs[READ_BYTE()]); break;
+			case TOS_1 | OP_GET_INPUT: PUSH_1(vm->inputs[READ_BYTE()]); break;
+			case TOS_2 | OP_GET_INPUT: PUSH_2(vm->inputs[READ_BYTE()]); break;
+			// a slot at or above sp is one of the cached values, a local
+			// whose declaration just pushed it for one
+			case TOS_0 | OP_GET_LOCAL: PUSH_0(vm->base[READ_BYTE()]); break;
+			case TOS_1 | OP_GET_LOCAL: {
+				const value_t* at = vm->base + READ_BYTE();
+				PUSH_1(at < sp ? *at : r0);
+				break;
+			}
+			case TOS_2 | OP_GET_LOCAL: {
+				const value_t* at = vm->base + READ_BYTE();
+				PUSH_2(at < sp ? *at : at == sp ? r1 : r0);
+				break;
+			}
+			case TOS_0 | OP_SET_LOCAL: CACHE_ONE(); FALLTHROUGH;
+			case TOS_1 | OP_SET_LOCAL: {
+				value_t* at = vm->base + READ_BYTE();
+				if(at < sp) *at = r0;
+				break;
+			}
+			case TOS_2 | OP_SET_LOCAL: {
+				value_t* at = vm->base + READ_BYTE();
+				if(at < sp) *at = r0;
+				else if(at == sp) r1 = r0;
+				break;
+			}
+			case TOS_0 | OP_POP: --sp;				break;
+			case TOS_1 | OP_POP: state = TOS_0;			break;
+			case TOS_2 | OP_POP: r0 = r1; state = TOS_1; break;
+			BINARY_CASES(OP_ADD_NUM_NUM):	   CACHED_NUMBER_OPERATION(+, OP_ADD);						break;
+			BINARY_CASES(OP_SUBTRACT_NUM_NUM): CACHED_NUMBER_OPERATION(-, OP_SUBTRACT);					break;
+			BINARY_CASES(OP_MULTIPLY_NUM_NUM): CACHED_NUMBER_OPERATION(*, OP_MULTIPLY);					break;
+			BINARY_CASES(OP_DIVIDE_NUM_NUM):   CACHED_NUMBER_OPERATION(/, OP_DIVIDE);					break;
+			BINARY_CASES(OP_ADD_INT_INT):	   CACHED_INT_OPERATION(__builtin_add_overflow, +, OP_ADD);		break;
+			BINARY_CASES(OP_SUBTRACT_INT_INT): CACHED_INT_OPERATION(__builtin_sub_overflow, -, OP_SUBTRACT); break;
+			BINARY_CASES(OP_MULTIPLY_INT_INT): CACHED_INT_OPERATION(__builtin_mul_overflow, *, OP_MULTIPLY); break;
+			// arrays allocate, so they go the plain way
+			UNARY_CASES(OP_NEGATION): {
+				if(IS_NUMBER(r0)) r0 = NUMBER_VAL(-AS_NUMBER(r0));
+				else if(IS_INT(r0)) r0 = negate_value(r0);
+				else FALLBACK();
+				break;
+			}
+			UNARY_CASES(OP_NOT): r0 = BOOL_VAL(is_falsey(r0)); break;
+			BINARY_CASES(OP_EQUAL): {
+				r0 = BOOL_VAL(values_equal(r1, r0));
+				state = TOS_1;
+				break;
+			}
+			BINARY_CASES(OP_NOT_EQUAL): {
+				r0 = BOOL_VAL(!values_equal(r1, r0));
+				state = TOS_1;
+				break;
+			}
+			BINARY_CASES(OP_LESS):			CACHED_COMPARISON(<);  break;
+			BINARY_CASES(OP_LESS_EQUAL):	CACHED_COMPARISON(<=); break;
+			BINARY_CASES(OP_GREATER):		CACHED_COMPARISON(>);  break;
+			BINARY_CASES(OP_GREATER_EQUAL): CACHED_COMPARISON(>=); break;
+			case TOS_0 | OP_JUMP:
+			case TOS_1 | OP_JUMP:
+			case TOS_2 | OP_JUMP: {
+				uint16_t offset = READ_SHORT();
+				pc += offset;
+				break;
+			}
+			case TOS_0 | OP_LOOP:
+			case TOS_1 | OP_LOOP:
+			case TOS_2 | OP_LOOP: {
+				uint16_t offset = READ_SHORT();
+				pc -= offset;
+				if((vm->slice_left -= offset) <= 0) {
+					FLUSH();
+					SAVE_REGISTERS();
+					return INTERPRETER_YIELD;
+				}
+				break;
+			}
+			UNARY_CASES(OP_JUMP_IF_FALSE): {
+				uint16_t offset = READ_SHORT();
+				if(is_falsey(r0)) pc += offset;
+				DROP_TOP();
+				break;
+			}
+			UNARY_CASES(OP_JUMP_IF_FALSE_OR_POP): {
+				uint16_t offset = READ_SHORT();
+				if(is_falsey(r0)) pc += offset;
+				else DROP_TOP();
+				break;
+			}
+			UNARY_CASES(OP_JUMP_IF_TRUE_OR_POP): {
+				uint16_t offset = READ_SHORT();
+				if(!is_falsey(r0)) pc += offset;
+				else DROP_TOP();
+				break;
+			}
+			BINARY_CASES(OP_JUMP_IF_NOT_EQUAL): {
+				uint16_t offset = READ_SHORT();
+				state = TOS_0;
+				if(!values_equal(r1, r0)) pc += offset;
+				break;
+			}
+			BINARY_CASES(OP_JUMP_IF_EQUAL): {
+				uint16_t offset = READ_SHORT();
+				state = TOS_0;
+				if(values_equal(r1, r0)) pc += offset;
+				break;
+			}
+			BINARY_CASES(OP_JUMP_IF_NOT_LESS):			CACHED_JUMP_UNLESS_COMPARISON(<);  break;
+			BINARY_CASES(OP_JUMP_IF_NOT_LESS_EQUAL):	CACHED_JUMP_UNLESS_COMPARISON(<=); break;
+			BINARY_CASES(OP_JUMP_IF_NOT_GREATER):		CACHED_JUMP_UNLESS_COMPARISON(>);  break;
+			BINARY_CASES(OP_JUMP_IF_NOT_GREATER_EQUAL): CACHED_JUMP_UNLESS_COMPARISON(>=); break;
+			UNARY_CASES(OP_CALL_NATIVE_1): {
+				native_number_1_t function = natives[READ_BYTE()].as.number_1;
+				if(!IS_NUMERIC(r0)) {
+					RUNTIME_ERROR("argument must be a number");
+				}
+				r0 = NUMBER_VAL(function(AS_FLOAT(r0)));
+				break;
+			}
+			BINARY_CASES(OP_CALL_NATIVE_2): {
+				native_number_2_t function = natives[READ_BYTE()].as.number_2;
+				if(!IS_NUMERIC(r1) || !IS_NUMERIC(r0)) {
+					RUNTIME_ERROR("arguments must be numbers");
+				}
+				r0 = NUMBER_VAL(function(AS_FLOAT(r1), AS_FLOAT(r0)));
+				state = TOS_1;
+				break;
+			}
+			BINARY_CASES(OP_INDEX): {
+				int64_t at;
+				if(!IS_ARRAY(r1)) {
+					RUNTIME_ERROR("only arrays can be indexed");
+				}
+				if(!whole_number(r0, &at) || at < 0 || at >= AS_ARRAY(r1)->length) {
+					RUNTIME_ERROR("array index out of range");
+				}
+				r0 = NUMBER_VAL(AS_ARRAY(r1)->data[at]);
+				state = TOS_1;
+				break;
+			}
+			// the result stays cached for the caller, the frame's values go
+			UNARY_CASES(OP_RETURN): {
+				value_t result = r0;
+				if(--vm->frame_count == 0) {
+					vm->result = result;
+					return INTERPRETER_OK;
+				}
+
+				sp = vm->base;
+				r0 = result;
+				state = TOS_1;
+
+				call_frame_s* frame = &vm->frames[vm->frame_count - 1];
+				vm->chunk = frame->chunk;
+				vm->base  = frame->base;
+				pc    = frame->pc;
+				break;
+			}
+			default:
+				FALLBACK();
 		}
 	}
-	return ret_val;
 
 #undef READ_BYTE
+#undef PUSH
+#undef POP
+#undef PEEK
+#undef SAVE_REGISTERS
+#undef RUNTIME_ERROR
+#undef READ_OPCODE
 #undef READ_CONSTANT
-#undef BINARY_OPERATION
+#undef READ_SHORT
+#undef CHARGE_SLICE
+#undef BINARY_NUMBER_OPERATION
+#undef BINARY_INT_OPERATION
+#undef COMPARE
+#undef COMPARISON_OPERATION
+#undef TOS_0
+#undef TOS_1
+#undef TOS_2
+#undef FALLTHROUGH
+#undef CACHE_ONE
+#undef CACHE_TWO
+#undef FLUSH
+#undef FALLBACK
+#undef PUSH_0
+#undef PUSH_1
+#undef PUSH_2
+#undef DROP_TOP
+#undef UNARY_CASES
+#undef BINARY_CASES
+#undef CACHED_NUMBER_OPERATION
+#undef CACHED_INT_OPERATION
+#undef CACHED_COMPARISON
+#undef CACHED_JUMP_UNLESS_COMPARISON
+#undef JUMP_UNLESS_COMPARISON
+}
+
+static void reset_stack(vm_s* vm)
+{
+	vm->sp = vm->stack;
+	vm->base = vm->stack;
+	vm->frame_count = 0;
 }
 
-static value_t pop()
+static void reserve_stack(vm_s* vm, const uint _depth)
 {
-	if(vm.stack >= vm.sp) assert(0);
-	--vm.sp;
-	return *vm.sp;
+	if(vm->stack_capacity >= _depth) return;
+
+	vm->stack = GROW_ARRAY(value_t, vm->stack, vm->stack_capacity, _depth, MEMORY_STACK);
+	vm->stack_capacity = _depth;
 }
 
-static void push(value_t _value)
+// a new stack, the pointers into the old one are moved over
+static void grow_stack(vm_s* vm, const uint _depth)
 {
-	if((vm.stack + STACK_MAX) <= vm.sp) assert(0);
-	*vm.sp = _value;
-	++vm.sp;
+	value_t* stack = ALLOCATE(value_t, _depth, MEMORY_STACK);
+	memcpy(stack, vm->stack, sizeof(value_t) * (size_t)(vm->sp - vm->stack));
+	for(uint i = 0; i < vm->frame_count; ++i) {
+		vm->frames[i].base = stack + (vm->frames[i].base - vm->stack);
+	}
+	vm->base = stack + (vm->base - vm->stack);
+	vm->sp = stack + (vm->sp - vm->stack);
+
+	FREE_ARRAY(value_t, vm->stack, vm->stack_capacity, MEMORY_STACK);
+	vm->stack = stack;
+	vm->stack_capacity = _depth;
 }
 
-static void reset_stack()
+// frames are only ever looked up by index, so they can just move. The stack
+// grows along.
+static void grow_frames(vm_s* vm)
 {
-	memset(vm.stack, '\0', STACK_MAX);
-	vm.sp = vm.stack;
+	uint capacity = vm->frame_capacity * 2;
+	if(capacity > FRAMES_MAX) capacity = FRAMES_MAX;
+	vm->frames = GROW_ARRAY(call_frame_s, vm->frames, vm->frame_capacity, capacity, MEMORY_STACK);
+	vm->frame_capacity = capacity;
+	fit_stack(vm);
 }
 
+// room for frames[] full: the script at the bottom and every other frame as
+// deep as the deepest function. A callee's frame starts within its caller's,
+// so no call has to check.
+static void fit_stack(vm_s* vm)
+{
+	const size_t depth = (size_t)vm->frames[0].chunk->stack_depth
+					   + (size_t)vm->frame_depth * (vm->frame_capacity - 1);
+	if(depth > vm->stack_capacity) grow_stack(vm, (uint)depth);
+}
+
+// runs a collection first when it's due. Whatever the caller still needs
+// has to be on the stack by then.
+static array_s* new_vm_array(vm_s* vm, const uint _length)
+{
+	const size_t size = array_size(_length);
+	if(vm->array_bytes + size > vm->collect_at) collect_arrays(vm);
+
+	array_s* array = reuse_array(vm, _length);
+	if(!array) array = new_array(_length);
+	array->next = vm->arrays;
+	vm->arrays = array;
+	vm->array_bytes += size;
+	return array;
+}
+
+// mark and sweep. Arrays hold no other values and nothing outside the stack
+// can hold an array while the vm runs, so the stack is the only root. What
+// is swept becomes a spare: freeing it right away gives the memory back to
+// the system, only to fault it in again for the next array of the loop.
+static void collect_arrays(vm_s* vm)
+{
+	for(value_t* value = vm->stack; value < vm->sp; ++value) {
+		if(IS_ARRAY(*value)) AS_ARRAY(*value)->marked = true;
+	}
+
+	// spares nobody took since the last collection aren't coming back
+	while(vm->spares) {
+		array_s* array = vm->spares;
+		vm->spares = array->next;
+		free_array(array);
+	}
+
+	array_s** link = &vm->arrays;
+	while(*link) {
+		array_s* array = *link;
+		if(array->marked) {
+			array->marked = false;
+			link = &array->next;
+			continue;
+		}
+		*link = array->next;
+		vm->array_bytes -= array_size(array->length);
+		array->next = vm->spares;
+		vm->spares = array;
+	}
+	vm->collect_at = vm->array_bytes * 2 > ARRAYS_COLLECT_MIN ? vm->array_bytes * 2 : ARRAYS_COLLECT_MIN;
+}
+
+static array_s* reuse_array(vm_s* vm, const uint _length)
+{
+	array_s** link = &vm->spares;
+	for(uint i = 0; *link && i < ARRAYS_REUSE_SEARCH; ++i, link = &(*link)->next) {
+		if((*link)->length != _length) continue;
+		array_s* array = *link;
+		*link = array->next;
+		return array;
+	}
+	return NULL;
+}
+
+static void free_arrays(vm_s* vm)
+{
+	while(vm->arrays) {
+		array_s* array = vm->arrays;
+		vm->arrays = array->next;
+		free_array(array);
+	}
+	while(vm->spares) {
+		array_s* array = vm->spares;
+		vm->spares = array->next;
+		free_array(array);
+	}
+	vm->array_bytes = 0;
+	vm->collect_at = ARRAYS_COLLECT_MIN;
+}
+
+// arithmetic with an array on at least one side. A number on the other side
+// is applied to every element, two arrays have to be of the same length.
+// Returns what went wrong, NULL if _result was set.
+static const char* broadcast(vm_s* vm, const opcode_e _opcode, const value_t _a, const value_t _b, value_t* _result)
+{
+	if((!IS_ARRAY(_a) && !IS_NUMERIC(_a)) || (!IS_ARRAY(_b) && !IS_NUMERIC(_b))) return "operands must be numbers";
+	if(IS_ARRAY(_a) && IS_ARRAY(_b) && AS_ARRAY(_a)->length != AS_ARRAY(_b)->length) return "arrays must be of the same length";
+
+	const double a_number = IS_ARRAY(_a) ? 0 : AS_FLOAT(_a);
+	const double b_number = IS_ARRAY(_b) ? 0 : AS_FLOAT(_b);
+	const double* a = IS_ARRAY(_a) ? AS_ARRAY(_a)->data : &a_number;
+	const double* b = IS_ARRAY(_b) ? AS_ARRAY(_b)->data : &b_number;
+	const uint length = IS_ARRAY(_a) ? AS_ARRAY(_a)->length : AS_ARRAY(_b)->length;
+
+	static const array_operation_e operations[] = {
+		[OP_ADD] = ARRAY_ADD, [OP_SUBTRACT] = ARRAY_SUBTRACT, [OP_MULTIPLY] = ARRAY_MULTIPLY, [OP_DIVIDE] = ARRAY_DIVIDE,
+	};
+	array_s* array = new_vm_array(vm, length);
+	array_apply(operations[_opcode], array->data, a, IS_ARRAY(_a), b, IS_ARRAY(_b), length);
+	*_result = ARRAY_VAL(array);
+	return NULL;
+}
+
+// an int, or a double without a fraction that fits in one
+static bool whole_number(const value_t _value, int64_t* _number)
+{
+	if(IS_INT(_value)) {
+		*_number = AS_INT(_value);
+		return true;
+	}
+	if(!IS_NUMBER(_value)) return false;
+	const double number = AS_NUMBER(_value);
+	if(!(number >= -9223372036854775808.0 && number < 9223372036854775808.0)) return false;
+	if(number != (double)(int64_t)number) return false;
+	*_number = (int64_t)number;
+	return true;
+}
+
+static void runtime_error(vm_s* vm, const char* _message)
+{
+	uint offset = (uint)(vm->pc - vm->chunk->data - 1);
+	fprintf(stderr, "[line %d] Runtime error: %s\n", vm->chunk->lines[offset], _message);
+	reset_stack(vm);
+}
+
+// picks the quickened variant of a generic arithmetic opcode for the
+// operand types at hand. Returns the generic opcode if there is none.
+static opcode_e specialize(const opcode_e _generic, const value_t _a, const value_t _b)
+{
+	if(IS_NUMBER(_a) && IS_NUMBER(_b)) {
+		switch(_generic) {
+			case OP_ADD:	  return OP_ADD_NUM_NUM;
+			case OP_SUBTRACT: return OP_SUBTRACT_NUM_NUM;
+			case OP_MULTIPLY: return OP_MULTIPLY_NUM_NUM;
+			case OP_DIVIDE:	  return OP_DIVIDE_NUM_NUM;
+			default: break;
+		}
+	}
+	if(IS_INT(_a) && IS_INT(_b)) {
+		switch(_generic) {
+			case OP_ADD:	  return OP_ADD_INT_INT;
+			case OP_SUBTRACT: return OP_SUBTRACT_INT_INT;
+			case OP_MULTIPLY: return OP_MULTIPLY_INT_INT;
+			default: break;
+		}
+	}
+	return _generic;
+}
+
+// several vm instances may run the same chunk on different threads. Opcodes
+// are the only bytes ever written while running, and every opcode is read
+// and written atomically, so a thread sees either the generic or the
+// quickened form - both are correct for any operands.
+static inline void rewrite_instruction(uint8_t* _at, const opcode_e _opcode)
+{
+	__atomic_store_n(_at, (uint8_t)_opcode, __ATOMIC_RELAXED);
+}